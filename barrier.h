@@ -0,0 +1,43 @@
+#ifndef BARRIER_H
+#define BARRIER_H
+
+//the launch barrier part2 and part3 park their children at before the first SIGUSR1
+//static inline, so each program keeps building from its one .c file
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+
+static inline void setup_launch_barrier(int *barrier) {
+    //the write end is close-on-exec, so a child's exec is reported to the MCP as that end closing
+    if (pipe(barrier) < 0 || fcntl(barrier[1], F_SETFD, FD_CLOEXEC) < 0) {
+        perror("pipe");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static inline void wait_at_barrier(int fd, int count) {
+    //reads count reports from the barrier, or until every child has closed it when count is 0
+    //a child that dies early closes its end too, so this can't block on a child that will never report
+    char buffer[256];
+    int seen = 0;
+    while (count == 0 || seen < count) {
+        size_t want = count == 0 || count - seen > (int)sizeof(buffer) ? sizeof(buffer) : (size_t)(count - seen);
+        ssize_t n = read(fd, buffer, want);
+        if (n <= 0) break;
+        seen += n;
+    }
+}
+
+static inline void confirm_stopped(pid_t *pids, int count) {
+    //waits until every child is reported stopped or exited
+    //WNOWAIT leaves the report in place, so the children are still reaped the usual way later
+    siginfo_t info;
+    for (int i = 0; i < count; i++) {
+        waitid(P_PID, pids[i], &info, WSTOPPED | WEXITED | WNOWAIT);
+    }
+}
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef CONTROL_H
+#define CONTROL_H
+
+//what mcpd and mcpctl have to agree on, the socket they meet at and how long a command line may be
+//static inline, so each program keeps building from its one .c file
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/un.h>
+
+#define CONTROL_MAX 1024 //longest control command line the MCP reads, from stdin or a client
+
+static inline const char *default_socket(void) {
+    //$XDG_RUNTIME_DIR/mcpd.sock, private to the user, else /tmp/mcpd-<uid>.sock
+    static char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+    const char *dir = getenv("XDG_RUNTIME_DIR");
+    if (dir && *dir) snprintf(path, sizeof(path), "%s/mcpd.sock", dir);
+    else snprintf(path, sizeof(path), "/tmp/mcpd-%d.sock", (int)getuid());
+    return path;
+}
+
+#endif
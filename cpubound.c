@@ -5,37 +5,150 @@
 #include <unistd.h>
 #include <time.h>
 
+#define CHECK_EVERY 65536 //iterations between looks at the clock, so timing costs next to nothing
+#define CACHE_LINE 64
+
+enum { MODE_CPU, MODE_MEMBW, MODE_CACHE };
+
+//created for cpubound
+double cpu_seconds(void); //cpu time this process has used
+double wall_seconds(void); //CLOCK_MONOTONIC
+unsigned long long run_cpu(unsigned long long count, unsigned long long *state); //count rounds of xorshift, the alu
+unsigned long long run_membw(unsigned long long count, unsigned long long *words, size_t length, size_t *at); //streams through the buffer
+unsigned long long run_cache(unsigned long long count, size_t *chain, size_t *at); //chases a random cycle through the buffer
+
 int main(int argc, char **argv) {
-    int i, j, now, start, condition = 1, seconds = 30;
-    double duration;
+    int i, mode = MODE_CPU;
+    long long megabytes = -1; //-1 until -memory, each mode has its own default
+    unsigned long long iterations = 0, done = 0; //0: run for -seconds instead
+    double seconds = 30;
+    const char *modes[] = { "cpu", "membw", "cache" };
+    const char *units[] = { "ops", "bytes", "loads" };
+    char *memory = NULL;
 
 /*
  * process environment variable and command line arguments
  */
     for (i = 1; i < argc; i++) {
-        if (strcmp(argv[i], "-seconds") == 0) {
-            seconds = atoi(argv[i + 1]);
-            break;
+        if (strcmp(argv[i], "-seconds") == 0 && i + 1 < argc) {
+            seconds = atof(argv[++i]);
+        } else if (strcmp(argv[i], "-iterations") == 0 && i + 1 < argc) {
+            iterations = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-memory") == 0 && i + 1 < argc) {
+            megabytes = atoll(argv[++i]);
+        } else if (strcmp(argv[i], "-mode") == 0 && i + 1 < argc) {
+            i++;
+            for (mode = 0; mode < 3 && strcmp(argv[i], modes[mode]) != 0; mode++);
+            if (mode == 3) {
+                fprintf(stderr, "Unknown mode `%s' (cpu, membw, cache)\n", argv[i]);
+                exit(1);
+            }
         } else {
             fprintf(stderr, "Illegal flag: `%s'\n", argv[i]);
             exit(1);
         }
     }
+    //membw streams through more than any cache holds, cache chases pointers through a bit more than a big L3
+    if (megabytes < 0) megabytes = mode == MODE_MEMBW ? 256 : mode == MODE_CACHE ? 64 : 0;
+    if (mode != MODE_CPU && megabytes == 0) megabytes = 1;
 
+    //line buffered, so a harness reading a pipe sees the start and finish when they happen
+    setvbuf(stdout, NULL, _IOLBF, 0);
     printf("Process: %d - Begining calculation.\n", getpid());
 
-    start = clock();
-    while(condition) {
-      i=0;
-      for(j = 0; j<100; j++) {
-        i = i+(i*2);
-      }
-      //check if done
-      now = clock();
-      duration =  (now - start)/(double) CLOCKS_PER_SEC;
-      //printf("Duration: %f - Seconds: %d - condition: %d\n", duration, seconds, duration>=seconds);
-      if(duration >= seconds) {condition = 0;}
+    //-memory: keep that many megabytes resident while calculating, and the buffer membw and cache work on
+    size_t bytes = (size_t)megabytes << 20;
+    if (bytes > 0) {
+        memory = malloc(bytes);
+        if (!memory) {
+            perror("malloc");
+            exit(1);
+        }
+        memset(memory, 1, bytes);
+    }
+
+    //cache: one link per cache line, shuffled into a single cycle (Sattolo) so no prefetcher can follow it
+    size_t *chain = (size_t *)memory, stride = CACHE_LINE / sizeof(size_t), links = bytes / CACHE_LINE, at = 0;
+    if (mode == MODE_CACHE) {
+        unsigned long long seed = 88172645463325252ULL;
+        for (size_t k = 0; k < links; k++) chain[k * stride] = k * stride;
+        for (size_t k = links - 1; k > 0; k--) {
+            seed ^= seed << 13, seed ^= seed >> 7, seed ^= seed << 17;
+            size_t j = seed % k, swap = chain[k * stride];
+            chain[k * stride] = chain[j * stride];
+            chain[j * stride] = swap;
+        }
+    }
+
+    //the work runs in chunks between clock checks; -iterations stops after exactly that many,
+    //-seconds once the process has had that much cpu, however long the scheduler kept it waiting
+    unsigned long long state = 0x9e3779b97f4a7c15ULL;
+    volatile unsigned long long sink = 0; //keeps the compiler from dropping work whose result is never used
+    double cpu_start = cpu_seconds(), wall_start = wall_seconds();
+    while (iterations ? done < iterations : cpu_seconds() - cpu_start < seconds) {
+        unsigned long long chunk = CHECK_EVERY;
+        if (iterations && iterations - done < chunk) chunk = iterations - done;
+        switch (mode) {
+        case MODE_CPU:   sink += run_cpu(chunk, &state); break;
+        case MODE_MEMBW: sink += run_membw(chunk, (unsigned long long *)memory, bytes / sizeof(unsigned long long), &at); break;
+        case MODE_CACHE: sink += run_cache(chunk, chain, &at); break;
+        }
+        done += chunk;
     }
-    printf("Process: %d - Finished.\n", getpid());
+    double cpu = cpu_seconds() - cpu_start, wall = wall_seconds() - wall_start;
+
+    //throughput is per second of cpu, what the job achieved while it actually ran; membw counts the
+    //bytes it read, each of which it also wrote back
+    unsigned long long work = mode == MODE_MEMBW ? done * sizeof(unsigned long long) : done;
+    free(memory);
+    printf("Process: %d - Finished. %llu %s %s in %.3f s cpu, %.3f s wall, %.0f %s/s\n", getpid(), work,
+           modes[mode], units[mode], cpu, wall, cpu > 0 ? work / cpu : 0, units[mode]);
     return 0;
 }
+
+double cpu_seconds(void) {
+    //cpu time this process has used
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+double wall_seconds(void) {
+    //CLOCK_MONOTONIC
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+unsigned long long run_cpu(unsigned long long count, unsigned long long *state) {
+    //count rounds of xorshift, the alu and nothing else, each depending on the last
+    unsigned long long x = *state;
+    for (unsigned long long k = 0; k < count; k++) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+    }
+    *state = x;
+    return x;
+}
+
+unsigned long long run_membw(unsigned long long count, unsigned long long *words, size_t length, size_t *at) {
+    //streams through the buffer, reading and rewriting count words and wrapping at its end
+    unsigned long long sum = 0;
+    size_t k = *at;
+    for (unsigned long long n = 0; n < count; n++) {
+        sum += words[k];
+        words[k] = sum;
+        if (++k == length) k = 0;
+    }
+    *at = k;
+    return sum;
+}
+
+unsigned long long run_cache(unsigned long long count, size_t *chain, size_t *at) {
+    //chases the random cycle, every load misses the caches and waits on the one before it
+    size_t k = *at;
+    for (unsigned long long n = 0; n < count; n++) k = chain[k];
+    *at = k;
+    return k;
+}
@@ -0,0 +1,25 @@
+#ifndef DURATION_H
+#define DURATION_H
+
+//the one parser for quanta and intervals, shared by part3 and part4 so both accept the same spellings
+//static inline, so each program keeps building from its one .c file
+
+#include <stdlib.h>
+#include <string.h>
+
+static inline long long parse_duration(const char *str) {
+    //parses "10ms", "250us", "1.5s" into nanoseconds, a bare number means seconds, -1 if invalid
+    char *end;
+    double value = strtod(str, &end);
+    if (end == str || value < 0) return -1;
+
+    double scale;
+    if (*end == '\0' || strcmp(end, "s") == 0) scale = 1e9;
+    else if (strcmp(end, "ms") == 0) scale = 1e6;
+    else if (strcmp(end, "us") == 0 || strcmp(end, "\xc2\xb5s") == 0) scale = 1e3;
+    else if (strcmp(end, "ns") == 0) scale = 1;
+    else return -1;
+    return (long long)(value * scale);
+}
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+//log-linear histogram shared by iobound (i/o latencies) and part4 (waits for --adaptive)
+//static inline, so each program keeps building from its one .c file
+
+#define HIST_SUB 8 //buckets per power of two, so a percentile is good to an eighth of its value
+
+typedef struct {
+    unsigned long long count[64 * HIST_SUB]; //by the position of the top bit, then the three bits under it
+    unsigned long long total;
+    long long max;
+} histogram_t;
+
+static inline void record_latency(histogram_t *hist, long long value) {
+    //counts one sample under the position of its top bit and the three bits below that
+    if (value < 1) value = 1;
+    int top = 63 - __builtin_clzll(value);
+    int sub = top >= 3 ? (value >> (top - 3)) & (HIST_SUB - 1) : (value << (3 - top)) & (HIST_SUB - 1);
+    hist->count[top * HIST_SUB + sub]++;
+    hist->total++;
+    if (value > hist->max) hist->max = value;
+}
+
+static inline long long latency_percentile(const histogram_t *hist, double percent) {
+    //lower edge of the bucket holding that rank, within an eighth of the real value
+    unsigned long long rank = (unsigned long long)(hist->total * percent / 100), seen = 0;
+    if (rank >= hist->total) rank = hist->total - 1;
+    for (int k = 0; k < 64 * HIST_SUB; k++) {
+        seen += hist->count[k];
+        if (seen > rank) return ((long long)(HIST_SUB + k % HIST_SUB) << (k / HIST_SUB)) >> 3;
+    }
+    return hist->max;
+}
+
+static inline void histogram_halve(histogram_t *hist) {
+    //halves every count, so older samples weigh half as much as the ones recorded after
+    hist->total = 0;
+    for (int k = 0; k < 64 * HIST_SUB; k++) {
+        hist->count[k] /= 2;
+        hist->total += hist->count[k];
+    }
+}
+
+#endif
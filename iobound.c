@@ -1,45 +1,417 @@
+#define _GNU_SOURCE //O_DIRECT
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <time.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "histogram.h"
+
+#define DIRECT_ALIGN 4096 //O_DIRECT wants buffers, offsets and lengths aligned to the device's block size, a page covers any of them
+
+enum { MODE_WRITE, MODE_FSYNC };
+enum { BACKEND_BUFFERED, BACKEND_DIRECT, BACKEND_MMAP, BACKEND_URING };
+
+typedef struct {
+    int fd;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array; //the submission ring, shared with the kernel
+    unsigned *cq_head, *cq_tail, *cq_mask; //the completion ring
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    unsigned pending; //queued in the ring but not yet taken by io_uring_enter
+} uring_t;
+
+typedef struct {
+    int backend, mode, depth;
+    int wall; //-wall: run for wall time instead of cpu time
+    double clock_read, cpu; //run_clock: when the cpu clock was last read, and what it said
+    int fd;
+    long long block, span; //span: how much of the file is used, a whole number of blocks
+    char *buffer; //a block for each request in flight, aligned for O_DIRECT
+    char *map; //mmap: the whole span
+    uring_t ring;
+    histogram_t latency; //of the phase running, reset between the writes and the readback
+    long long ops;
+} io_t;
+
+//created for iobound
+double cpu_seconds(void); //cpu time this process has used
+double wall_seconds(void); //CLOCK_MONOTONIC
+double run_clock(io_t *io); //what -seconds is measured on, cpu time or wall time under -wall
+long long now_ns(void); //CLOCK_MONOTONIC in nanoseconds, for latencies
+long long parse_size(const char *str); //parses "512M", "4k", "1G" into bytes, -1 if invalid
+void open_file(io_t *io, const char *dir); //creates the scratch file and whatever the backend needs to use it
+void setup_uring(uring_t *ring, unsigned entries); //io_uring_setup and the three ring mappings, no liburing
+long long run_sync(io_t *io, int reading, long long bytes, double seconds); //buffered, direct and mmap, a block at a time
+long long run_uring(io_t *io, int reading, long long bytes, double seconds); //keeps -depth requests in flight
+void drop_cache(io_t *io); //writes back and evicts the file, so the readback comes from the device
+void print_latency(const char *what, const histogram_t *hist); //p50, p99, p99.9 and max in microseconds
 
 int main(int argc, char **argv) {
-    int i, j, now, start, condition = 1, seconds = 5;
-    double duration;
-    FILE *outfile = fopen("/dev/null", "w");
+    int i, readback = 0;
+    long long bytes = 0, done = 0, read_bytes = 0; //bytes 0: run for -seconds instead
+    long long file_size = 64 << 20;
+    double seconds = 5, read_wall = 0;
+    const char *dir = ".", *modes[] = { "write", "fsync" }, *backends[] = { "buffered", "direct", "mmap", "uring" };
+    io_t io = { .backend = BACKEND_BUFFERED, .mode = MODE_WRITE, .depth = 8, .block = 4096 };
 
 /*
  * process environment variable and command line arguments
  */
     for (i = 1; i < argc; i++) {
-        if (strcmp(argv[i], "-seconds") == 0) {
-            seconds = atoi(argv[i + 1]);
-            break;
+        if (strcmp(argv[i], "-seconds") == 0 && i + 1 < argc) {
+            seconds = atof(argv[++i]);
+            io.wall = 0;
+        } else if (strcmp(argv[i], "-wall") == 0 && i + 1 < argc) {
+            seconds = atof(argv[++i]);
+            io.wall = 1;
+        } else if (strcmp(argv[i], "-bytes") == 0 && i + 1 < argc) {
+            bytes = parse_size(argv[++i]);
+        } else if (strcmp(argv[i], "-block") == 0 && i + 1 < argc) {
+            io.block = parse_size(argv[++i]);
+        } else if (strcmp(argv[i], "-file") == 0 && i + 1 < argc) {
+            file_size = parse_size(argv[++i]);
+        } else if (strcmp(argv[i], "-dir") == 0 && i + 1 < argc) {
+            dir = argv[++i];
+        } else if (strcmp(argv[i], "-depth") == 0 && i + 1 < argc) {
+            io.depth = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-read") == 0) {
+            readback = 1;
+        } else if (strcmp(argv[i], "-mode") == 0 && i + 1 < argc) {
+            i++;
+            for (io.mode = 0; io.mode < 2 && strcmp(argv[i], modes[io.mode]) != 0; io.mode++);
+            if (io.mode == 2) {
+                fprintf(stderr, "Unknown mode `%s' (write, fsync)\n", argv[i]);
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "-backend") == 0 && i + 1 < argc) {
+            i++;
+            for (io.backend = 0; io.backend < 4 && strcmp(argv[i], backends[io.backend]) != 0; io.backend++);
+            if (io.backend == 4) {
+                fprintf(stderr, "Unknown backend `%s' (buffered, direct, mmap, uring)\n", argv[i]);
+                exit(1);
+            }
         } else {
             fprintf(stderr, "Illegal flag: `%s'\n", argv[i]);
             exit(1);
         }
     }
+    if (bytes < 0 || io.block <= 0 || file_size <= 0) {
+        fprintf(stderr, "Invalid size (e.g. 4k, 64M, 1G)\n");
+        exit(1);
+    }
+    if (io.depth < 1) {
+        fprintf(stderr, "Invalid -depth %d\n", io.depth);
+        exit(1);
+    }
+    if (io.backend != BACKEND_URING) io.depth = 1;
+    if (io.backend == BACKEND_DIRECT) {
+        if (io.block % DIRECT_ALIGN != 0) {
+            fprintf(stderr, "The direct backend needs -block to be a multiple of %d\n", DIRECT_ALIGN);
+            exit(1);
+        }
+        bytes = (bytes + io.block - 1) / io.block * io.block; //no short last write either
+    }
+    if (file_size < io.block) file_size = io.block;
+    io.span = file_size - file_size % io.block;
 
+    //line buffered, so a harness reading a pipe sees the start and finish when they happen
+    setvbuf(stdout, NULL, _IOLBF, 0);
     printf("Process: %d - Begining to write to file.\n", getpid());
+    open_file(&io, dir);
+
+    //writes wrap at -file so a long run doesn't fill the disk; -bytes stops after that much,
+    //-seconds once the process has had that much cpu, like cpubound, -wall after that much wall time
+    double start = wall_seconds();
+    if (io.backend == BACKEND_URING) done = run_uring(&io, 0, bytes, seconds);
+    else done = run_sync(&io, 0, bytes, seconds);
+    //what mmap writes only reaches the file at msync, which belongs to the cost of writing it
+    if (io.backend == BACKEND_MMAP && io.mode == MODE_WRITE && msync(io.map, io.span, MS_SYNC) < 0) {
+        perror("msync");
+        exit(1);
+    }
+    double wall = wall_seconds() - start;
+    long long writes = io.ops;
+    print_latency("write", &io.latency);
+
+    //-read: read back what is in the file, with the same backend, once it is out of memory
+    if (readback) {
+        drop_cache(&io);
+        memset(&io.latency, 0, sizeof(io.latency));
+        io.ops = 0;
+        start = wall_seconds();
+        long long length = done < io.span ? done : io.span;
+        if (io.backend == BACKEND_URING) read_bytes = run_uring(&io, 1, length, 0);
+        else read_bytes = run_sync(&io, 1, length, 0);
+        read_wall = wall_seconds() - start;
+        print_latency("read", &io.latency);
+    }
+    close(io.fd);
 
-    start = clock();
-    while(condition) {
-      //write a line to the file
-      for(j = 0; j<100; j++) {
-        fprintf(outfile, "A string! ");
-      }
-      fprintf(outfile, "\n");
-      //check if done
-      now = clock();
-      duration =  (now - start)/(double) CLOCKS_PER_SEC;
-      //printf("Duration: %f - Seconds: %d - condition: %d\n", duration, seconds, duration>=seconds);
-      if(duration >= seconds) {condition = 0;}
-    }
-    fclose(outfile);
-
-    printf("Process: %d - Finished.\n", getpid());
+    printf("Process: %d - Finished. %lld %s-%s bytes in %lld writes, %.3f s wall, %.0f bytes/s, %.0f writes/s",
+           getpid(), done, backends[io.backend], modes[io.mode], writes, wall, wall > 0 ? done / wall : 0,
+           wall > 0 ? writes / wall : 0);
+    if (readback) printf(", read back %lld bytes at %.0f bytes/s", read_bytes, read_wall > 0 ? read_bytes / read_wall : 0);
+    printf("\n");
     return 0;
 }
+
+double cpu_seconds(void) {
+    //cpu time this process has used
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+double wall_seconds(void) {
+    //CLOCK_MONOTONIC
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+double run_clock(io_t *io) {
+    //what -seconds is measured on: cpu time, so a job waiting for the disk or the scheduler isn't
+    //counted as having run, or wall time under -wall. reading the cpu clock is a system call, which
+    //costs a buffered write a third of its throughput, so it is read at most once a millisecond
+    if (io->wall) return wall_seconds();
+    double now = wall_seconds();
+    if (now - io->clock_read >= 1e-3) {
+        io->clock_read = now;
+        io->cpu = cpu_seconds();
+    }
+    return io->cpu;
+}
+
+long long now_ns(void) {
+    //CLOCK_MONOTONIC in nanoseconds, for latencies
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+long long parse_size(const char *str) {
+    //parses "512M", "4k", "1G" into bytes, a bare number means bytes
+    char *end;
+    double value = strtod(str, &end);
+    if (end == str || value < 0) return -1;
+    switch (*end) {
+    case '\0': return (long long)value;
+    case 'k': case 'K': return (long long)(value * 1024);
+    case 'm': case 'M': return (long long)(value * 1024 * 1024);
+    case 'g': case 'G': return (long long)(value * 1024 * 1024 * 1024);
+    default: return -1;
+    }
+}
+
+void open_file(io_t *io, const char *dir) {
+    //a scratch file in -dir, unlinked at once so nothing is left behind however the job ends
+    //the default is the current directory because /tmp is often tmpfs, where fsync costs nothing;
+    //-dir /dev/shm measures exactly that
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/iobound-XXXXXX", dir);
+    io->fd = mkstemp(path);
+    if (io->fd < 0) {
+        perror("mkstemp");
+        exit(1);
+    }
+    if (io->backend == BACKEND_DIRECT) {
+        //mkstemp can't ask for O_DIRECT, so the file is opened again by name before it goes
+        int fd = open(path, O_RDWR | O_DIRECT);
+        if (fd < 0) {
+            perror("open O_DIRECT");
+            unlink(path);
+            exit(1);
+        }
+        close(io->fd);
+        io->fd = fd;
+    }
+    unlink(path);
+
+    if (posix_memalign((void **)&io->buffer, DIRECT_ALIGN, io->depth * io->block) != 0) {
+        perror("posix_memalign");
+        exit(1);
+    }
+    memset(io->buffer, 'A', io->depth * io->block);
+
+    if (io->backend == BACKEND_MMAP) {
+        if (ftruncate(io->fd, io->span) < 0) {
+            perror("ftruncate");
+            exit(1);
+        }
+        io->map = mmap(NULL, io->span, PROT_READ | PROT_WRITE, MAP_SHARED, io->fd, 0);
+        if (io->map == MAP_FAILED) {
+            perror("mmap");
+            exit(1);
+        }
+    }
+    if (io->backend == BACKEND_URING) setup_uring(&io->ring, io->depth);
+}
+
+void setup_uring(uring_t *ring, unsigned entries) {
+    //io_uring_setup and the three ring mappings, straight from the system calls so nothing needs liburing
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd < 0) {
+        perror("io_uring_setup");
+        exit(1);
+    }
+    size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    int single = params.features & IORING_FEAT_SINGLE_MMAP; //both rings in one mapping since 5.4
+    if (single && cq_size > sq_size) sq_size = cq_size;
+    char *sq = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    char *cq = single ? sq : mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    ring->sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (sq == MAP_FAILED || cq == MAP_FAILED || ring->sqes == MAP_FAILED) {
+        perror("mmap io_uring");
+        exit(1);
+    }
+    ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+    ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    ring->pending = 0;
+}
+
+long long run_sync(io_t *io, int reading, long long bytes, double seconds) {
+    //buffered, direct and mmap, a block at a time; the latency of a write includes its fdatasync
+    //or msync under -mode fsync, since that is what the job waits for
+    long long done = 0, page = sysconf(_SC_PAGESIZE);
+    double start = run_clock(io);
+    while (bytes ? done < bytes : run_clock(io) - start < seconds) {
+        long long length = io->block, offset = done % io->span, t = now_ns();
+        if (bytes && bytes - done < length) length = bytes - done;
+        if (io->backend == BACKEND_MMAP) {
+            if (reading) memcpy(io->buffer, io->map + offset, length);
+            else memcpy(io->map + offset, io->buffer, length);
+            long long from = offset - offset % page; //msync wants a page aligned address
+            if (!reading && io->mode == MODE_FSYNC && msync(io->map + from, offset + length - from, MS_SYNC) < 0) {
+                perror("msync");
+                exit(1);
+            }
+        } else {
+            ssize_t n = reading ? pread(io->fd, io->buffer, length, offset) : pwrite(io->fd, io->buffer, length, offset);
+            if (n != length) {
+                perror(reading ? "pread" : "pwrite");
+                exit(1);
+            }
+            if (!reading && io->mode == MODE_FSYNC && fdatasync(io->fd) < 0) {
+                perror("fdatasync");
+                exit(1);
+            }
+        }
+        record_latency(&io->latency, now_ns() - t);
+        done += length;
+        io->ops++;
+    }
+    return done;
+}
+
+long long run_uring(io_t *io, int reading, long long bytes, double seconds) {
+    //keeps -depth requests in flight, each in its own slot of the buffer; a request's latency runs
+    //from when it is queued to when its completion is seen. -mode fsync writes with RWF_DSYNC,
+    //which makes each write durable on its own instead of needing a linked fsync
+    uring_t *ring = &io->ring;
+    long long submitted = 0, done = 0, *started = malloc(io->depth * sizeof(long long));
+    int *free_slots = malloc(io->depth * sizeof(int)), spare = io->depth, inflight = 0;
+    if (!started || !free_slots) {
+        perror("malloc");
+        exit(1);
+    }
+    for (int k = 0; k < io->depth; k++) free_slots[k] = k;
+    double start = run_clock(io);
+    for (;;) {
+        while (spare > 0 && (bytes ? submitted < bytes : run_clock(io) - start < seconds)) {
+            int slot = free_slots[--spare];
+            long long length = io->block;
+            if (bytes && bytes - submitted < length) length = bytes - submitted;
+            unsigned tail = *ring->sq_tail, index = tail & *ring->sq_mask;
+            struct io_uring_sqe *sqe = &ring->sqes[index];
+            memset(sqe, 0, sizeof(*sqe));
+            sqe->opcode = reading ? IORING_OP_READ : IORING_OP_WRITE;
+            sqe->fd = io->fd;
+            sqe->addr = (unsigned long)(io->buffer + slot * io->block);
+            sqe->len = length;
+            sqe->off = submitted % io->span;
+            sqe->user_data = slot;
+            if (!reading && io->mode == MODE_FSYNC) sqe->rw_flags = RWF_DSYNC;
+            ring->sq_array[index] = index;
+            __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+            ring->pending++;
+            started[slot] = now_ns();
+            submitted += length;
+            inflight++;
+        }
+        if (inflight == 0) break;
+
+        //hand over whatever was queued and wait for at least one completion
+        int taken = syscall(__NR_io_uring_enter, ring->fd, ring->pending, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+        if (taken < 0) {
+            if (errno == EINTR) continue;
+            perror("io_uring_enter");
+            exit(1);
+        }
+        ring->pending -= taken;
+        unsigned head = *ring->cq_head;
+        while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+            struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+            if (cqe->res < 0) {
+                errno = -cqe->res;
+                perror(reading ? "io_uring read" : "io_uring write");
+                exit(1);
+            }
+            record_latency(&io->latency, now_ns() - started[cqe->user_data]);
+            free_slots[spare++] = cqe->user_data;
+            done += cqe->res;
+            io->ops++;
+            inflight--;
+            head++;
+        }
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    }
+    free(started);
+    free(free_slots);
+    return done;
+}
+
+void drop_cache(io_t *io) {
+    //writes back and evicts the file, so the readback comes from the device and not from the pages the
+    //writes left behind; O_DIRECT never had any, and on tmpfs the pages are all there is
+    if (io->backend == BACKEND_DIRECT) return;
+    if (io->backend == BACKEND_MMAP) {
+        //mapped pages can't be evicted, so the mapping goes while they are
+        munmap(io->map, io->span);
+    }
+    if (fdatasync(io->fd) < 0) {
+        perror("fdatasync");
+        exit(1);
+    }
+    posix_fadvise(io->fd, 0, 0, POSIX_FADV_DONTNEED);
+    if (io->backend == BACKEND_MMAP) {
+        io->map = mmap(NULL, io->span, PROT_READ | PROT_WRITE, MAP_SHARED, io->fd, 0);
+        if (io->map == MAP_FAILED) {
+            perror("mmap");
+            exit(1);
+        }
+    }
+}
+
+void print_latency(const char *what, const histogram_t *hist) {
+    //p50, p99, p99.9 and max in microseconds
+    if (hist->total == 0) return;
+    printf("Process: %d - %s latency p50 %.1f us, p99 %.1f us, p99.9 %.1f us, max %.1f us over %llu %ss\n", getpid(),
+           what, latency_percentile(hist, 50) / 1e3, latency_percentile(hist, 99) / 1e3,
+           latency_percentile(hist, 99.9) / 1e3, hist->max / 1e3, hist->total, what);
+}
@@ -0,0 +1,329 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <getopt.h>
+#include <sys/types.h>
+
+#define TRACE_MAGIC "MCPTRACE"
+#define TRACE_VERSION 1
+
+//record layout written by part4 --trace, keep in step with part4.c
+enum { LOG_SPAWN, LOG_RUN, LOG_STOP, LOG_EXIT, LOG_DEMOTE, LOG_BOOST, LOG_SAMPLE, LOG_DROP };
+typedef struct {
+    long long time; //CLOCK_MONOTONIC ns
+    int type;
+    pid_t pid;
+    int slot;
+    long long a, b; //counters, see log_kinds in part4.c
+    char name[20];
+} log_event_t;
+
+typedef struct {
+    char magic[8];
+    int version;
+    int record_size;
+    int slots;
+    int reserved;
+    long long start; //every job's submission time
+    char policy[16];
+} trace_header_t;
+
+typedef struct {
+    pid_t pid;
+    char name[20];
+    long long arrived; //submission, the start of the batch unless the job had arrive=
+    long long spawned, first_run, finished; //trace times, -1 until seen
+    long long run_start; //start of the slice in progress, -1 while not running
+    int run_slot;
+    long long on_cpu; //ns spent holding a slot
+    long long cpu_ms; //cpu time reported at exit
+    int switches; //times it was dispatched onto a slot
+    long long *bursts; //--profile: us of cpu (positive) and waiting (negative) seen in its samples
+    int burst_count, burst_capacity;
+    long long sampled_us; //cpu time covered by the samples
+} job_t;
+
+//created for mcp-analyze
+void read_trace(FILE *file); //replays every record of the trace into the job table
+job_t *job_for(pid_t pid, int spawn); //job currently using pid, a fresh one for a spawn
+void end_slice(job_t *job, long long time); //closes the running slice, exporting it to perfetto
+void print_report(void); //per-job table and batch totals
+void perfetto_event(const char *format, ...); //appends one trace-event object to the perfetto file
+void add_burst(job_t *job, long long us); //appends to the job's profile, merging with a burst of the same kind
+void write_profiles(const char *path); //one part4 --simulate job line per job
+
+trace_header_t header;
+job_t *jobs = NULL; //every job in spawn order
+size_t job_count = 0, job_capacity = 0;
+int *by_pid = NULL; //open-addressed pid -> index into jobs, -1 marks an empty bucket
+size_t pid_capacity = 0; //power of two, kept at least twice job_count
+long dropped = 0; //events the MCP lost, the numbers below undercount if this is not 0
+FILE *perfetto = NULL;
+int perfetto_events = 0;
+
+int main(int argc, char *argv[]) {
+    static struct option long_options[] = {
+        {"perfetto", required_argument, NULL, 'p'},
+        {"profile", required_argument, NULL, 'P'},
+        {NULL, 0, NULL, 0}
+    };
+    const char *perfetto_path = NULL, *profile_path = NULL;
+    int opt, usage = 0;
+
+    while (!usage && (opt = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 'p':
+            perfetto_path = optarg;
+            break;
+        case 'P':
+            profile_path = optarg;
+            break;
+        default:
+            usage = 1; //unknown option or missing argument, stop parsing and print the usage message
+        }
+    }
+    if (usage || optind != argc - 1) {
+        fprintf(stderr, "Usage: %s [--perfetto out.json] [--profile jobs.txt] <trace_file>\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    FILE *file = fopen(argv[optind], "rb");
+    if (!file) {
+        perror("fopen");
+        exit(EXIT_FAILURE);
+    }
+    if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, TRACE_MAGIC, 8) != 0
+        || header.version != TRACE_VERSION || header.record_size != (int)sizeof(log_event_t)) {
+        fprintf(stderr, "%s is not an MCP trace this tool understands\n", argv[optind]);
+        exit(EXIT_FAILURE);
+    }
+    if (perfetto_path) {
+        perfetto = fopen(perfetto_path, "w");
+        if (!perfetto) {
+            perror("fopen");
+            exit(EXIT_FAILURE);
+        }
+        fprintf(perfetto, "{\"traceEvents\":[\n");
+        perfetto_event("{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"MCP %s\"}}", header.policy);
+        for (int i = 0; i < header.slots; i++) {
+            perfetto_event("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"slot %d\"}}", i, i);
+        }
+    }
+
+    read_trace(file);
+    fclose(file);
+    print_report();
+    if (profile_path) write_profiles(profile_path);
+
+    if (perfetto) {
+        fprintf(perfetto, "\n]}\n");
+        fclose(perfetto);
+    }
+    return 0;
+}
+
+void read_trace(FILE *file) {
+    //replays every record of the trace into the job table
+    log_event_t e;
+    while (fread(&e, sizeof(e), 1, file) == 1) {
+        double ts = (e.time - header.start) / 1e3;
+        job_t *job = NULL;
+        if (e.type == LOG_SPAWN || e.type == LOG_RUN || e.type == LOG_STOP || e.type == LOG_EXIT) {
+            job = job_for(e.pid, e.type == LOG_SPAWN);
+            if (!job) continue; //spawned before a dropped stretch of the trace
+        }
+
+        switch (e.type) {
+        case LOG_SPAWN:
+            memcpy(job->name, e.name, sizeof(job->name));
+            job->arrived = header.start + e.b * 1000000;
+            job->spawned = e.time;
+            break;
+        case LOG_RUN:
+            if (job->first_run < 0) job->first_run = e.time;
+            job->run_start = e.time;
+            job->run_slot = e.slot;
+            job->switches++;
+            break;
+        case LOG_STOP:
+            end_slice(job, e.time);
+            break;
+        case LOG_EXIT:
+            end_slice(job, e.time);
+            job->finished = e.time;
+            job->cpu_ms = e.a;
+            if (e.a * 1000 > job->sampled_us) add_burst(job, e.a * 1000 - job->sampled_us); //its last, unsampled slice
+            if (perfetto) {
+                perfetto_event("{\"name\":\"exit %s\",\"ph\":\"i\",\"s\":\"p\",\"ts\":%.3f,\"pid\":1,\"tid\":0,\"args\":{\"pid\":%d}}",
+                               job->name, ts, job->pid);
+            }
+            break;
+        case LOG_BOOST:
+            if (perfetto) perfetto_event("{\"name\":\"boost\",\"ph\":\"i\",\"s\":\"g\",\"ts\":%.3f,\"pid\":1,\"tid\":0}", ts);
+            break;
+        case LOG_SAMPLE:
+            job = job_for(e.pid, 0);
+            if (!job) break;
+            add_burst(job, e.a);
+            if (e.b > e.a) add_burst(job, e.a - e.b);
+            job->sampled_us += e.a;
+            break;
+        case LOG_DROP:
+            dropped += e.a;
+            break;
+        }
+    }
+}
+
+job_t *job_for(pid_t pid, int spawn) {
+    //job currently using pid, a fresh one for a spawn
+    //a spawn replaces the pid's entry, so a pid the kernel reused later in the batch maps to its new job
+    if (spawn && (job_count + 1) * 2 > pid_capacity) {
+        free(by_pid);
+        pid_capacity = pid_capacity ? pid_capacity * 2 : 1024;
+        by_pid = malloc(pid_capacity * sizeof(int));
+        if (!by_pid) {
+            perror("malloc");
+            exit(EXIT_FAILURE);
+        }
+        memset(by_pid, -1, pid_capacity * sizeof(int));
+        for (size_t i = 0; i < job_count; i++) {
+            size_t bucket = (size_t)jobs[i].pid & (pid_capacity - 1);
+            while (by_pid[bucket] >= 0 && jobs[by_pid[bucket]].pid != jobs[i].pid) {
+                bucket = (bucket + 1) & (pid_capacity - 1);
+            }
+            by_pid[bucket] = i; //later jobs overwrite earlier ones with the same pid
+        }
+    }
+    if (pid_capacity == 0) return NULL;
+
+    size_t bucket = (size_t)pid & (pid_capacity - 1);
+    while (by_pid[bucket] >= 0 && jobs[by_pid[bucket]].pid != pid) {
+        bucket = (bucket + 1) & (pid_capacity - 1);
+    }
+    if (!spawn) return by_pid[bucket] >= 0 ? &jobs[by_pid[bucket]] : NULL;
+
+    if (job_count == job_capacity) {
+        job_capacity = job_capacity ? job_capacity * 2 : 256;
+        jobs = realloc(jobs, job_capacity * sizeof(job_t));
+        if (!jobs) {
+            perror("realloc");
+            exit(EXIT_FAILURE);
+        }
+    }
+    job_t *job = &jobs[job_count];
+    memset(job, 0, sizeof(*job));
+    job->pid = pid;
+    job->spawned = job->first_run = job->finished = job->run_start = -1;
+    by_pid[bucket] = job_count++;
+    return job;
+}
+
+void end_slice(job_t *job, long long time) {
+    //closes the running slice, exporting it to perfetto
+    if (job->run_start < 0) return;
+    job->on_cpu += time - job->run_start;
+    if (perfetto) {
+        perfetto_event("{\"name\":\"%s\",\"cat\":\"job\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d,\"args\":{\"pid\":%d}}",
+                       job->name, (job->run_start - header.start) / 1e3, (time - job->run_start) / 1e3, job->run_slot, job->pid);
+    }
+    job->run_start = -1;
+}
+
+void print_report(void) {
+    //per-job table and batch totals
+    //turnaround and response count from submission, the start of the batch unless the job had arrive=;
+    //wait is the part of the turnaround spent off a slot
+    double turnaround = 0, wait = 0, response = 0, cpu = 0, on_cpu = 0;
+    long switches = 0;
+    long long end = header.start;
+    size_t finished = 0;
+
+    printf("%8s %-20s %11s %11s %11s %8s %9s\n", "PID", "NAME", "TURNAROUND", "WAIT", "RESPONSE", "SWITCHES", "CPU");
+    for (size_t i = 0; i < job_count; i++) {
+        job_t *job = &jobs[i];
+        switches += job->switches;
+        on_cpu += job->on_cpu / 1e9;
+        if (job->finished < 0) {
+            printf("%8d %-20s %11s %11s %11s %8d %9s\n", job->pid, job->name, "-", "-", "-", job->switches, "-");
+            continue;
+        }
+        double t = (job->finished - job->arrived) / 1e9;
+        double w = t - job->on_cpu / 1e9;
+        double r = job->first_run >= 0 ? (job->first_run - job->arrived) / 1e9 : t;
+        printf("%8d %-20s %10.3fs %10.3fs %10.3fs %8d %8.3fs\n", job->pid, job->name, t, w, r, job->switches, job->cpu_ms / 1e3);
+        turnaround += t;
+        wait += w;
+        response += r;
+        cpu += job->cpu_ms / 1e3;
+        if (job->finished > end) end = job->finished;
+        finished++;
+    }
+
+    double makespan = (end - header.start) / 1e9;
+    printf("\nPolicy %s, %d slots, %zu jobs (%zu finished), makespan %.3f s\n",
+           header.policy, header.slots, job_count, finished, makespan);
+    if (finished > 0) {
+        printf("Mean turnaround %.3f s, mean wait %.3f s, mean response %.3f s\n",
+               turnaround / finished, wait / finished, response / finished);
+    }
+    printf("Context switches %ld", switches);
+    if (makespan > 0) {
+        //slot occupancy counts a job that was dispatched but sleeping, cpu utilisation only what it ran
+        printf(", slot occupancy %.1f%%, cpu utilisation %.1f%%",
+               100 * on_cpu / (makespan * header.slots), 100 * cpu / (makespan * header.slots));
+    }
+    printf("\n");
+    if (dropped > 0) printf("Warning: the MCP dropped %ld events, figures above undercount\n", dropped);
+}
+
+void perfetto_event(const char *format, ...) {
+    //appends one trace-event object to the perfetto file
+    va_list args;
+    if (perfetto_events++ > 0) fprintf(perfetto, ",\n");
+    va_start(args, format);
+    vfprintf(perfetto, format, args);
+    va_end(args);
+}
+
+void add_burst(job_t *job, long long us) {
+    //appends to the job's profile, merging with a burst of the same kind
+    if (us == 0) return;
+    if (job->burst_count > 0 && (job->bursts[job->burst_count - 1] > 0) == (us > 0)) {
+        job->bursts[job->burst_count - 1] += us;
+        return;
+    }
+    if (job->burst_count == job->burst_capacity) {
+        job->burst_capacity = job->burst_capacity ? job->burst_capacity * 2 : 8;
+        job->bursts = realloc(job->bursts, job->burst_capacity * sizeof(long long));
+        if (!job->bursts) {
+            perror("realloc");
+            exit(EXIT_FAILURE);
+        }
+    }
+    job->bursts[job->burst_count++] = us;
+}
+
+void write_profiles(const char *path) {
+    //one part4 --simulate job line per job, so a recorded batch can be replayed under other policies
+    //each slice's cpu time becomes a cpu burst and the rest of it, when the job was on a slot but not
+    //running, an i/o wait; waits that ran out while the job was stopped don't show in the trace
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        perror("fopen");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < job_count; i++) {
+        job_t *job = &jobs[i];
+        if (job->finished < 0) continue;
+        if (job->arrived > header.start) fprintf(file, "arrive=%lldms ", (job->arrived - header.start) / 1000000);
+        fprintf(file, "%s", job->name);
+        if (job->burst_count == 0) fprintf(file, " cpu:0us"); //exited before using a tick, still part of the batch
+        for (int b = 0; b < job->burst_count; b++) {
+            if (job->bursts[b] > 0) fprintf(file, " cpu:%lldus", job->bursts[b]);
+            else fprintf(file, " io:%lldus", -job->bursts[b]);
+        }
+        fprintf(file, "\n");
+    }
+    if (fclose(file) != 0) perror("profile");
+}
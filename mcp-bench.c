@@ -0,0 +1,472 @@
+#define _GNU_SOURCE //pipe2
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#define MAX_LIST 16 //most MCPs, policies or mixes in one run
+#define MAX_REPEAT 100
+#define PART_MAX_JOBS 100 //part1-3 read at most this many lines, bigger mixes only run under part4
+#define SAMPLE_MS 20 //how often the MCP's rss is sampled while it runs
+#define KINDS 6 //kinds of job a mix is made of, see kind_names
+#define MAX_WORK 8 //distinct kinds of work a run's jobs can report
+
+enum { KIND_CPU, KIND_IO, KIND_SHORT, KIND_MEM, KIND_CACHE, KIND_FSYNC };
+
+typedef struct {
+    char spec[128]; //as given on the command line, stored with the results
+    int count[KINDS]; //jobs of each kind
+    int seconds; //length of every job but the short ones
+    int mem_mb; //buffer each mem job streams through
+} mix_t;
+
+typedef struct {
+    double makespan; //MCP start to MCP exit, s
+    double p50, p99; //response time, MCP start to a job's first line of output, s
+    long switches; //times the MCP dispatched a job, from its log
+    double mcp_cpu; //the MCP's own user+system time, its jobs excluded, s
+    long mcp_rss_kb; //the MCP's own peak rss
+    int jobs, started;
+    char work_unit[MAX_WORK][32]; //"cpu ops", "buffered-fsync bytes", ... as the jobs' finish lines name them
+    unsigned long long work[MAX_WORK]; //summed over the jobs that reported that unit
+    int work_kinds;
+} result_t;
+
+//created for mcp-bench
+int parse_mix(const char *spec, mix_t *mix); //fills mix from a built-in name or "cpu=4,io=4,short=16,mem=2,cache=1,fsync=1,seconds=2", 0 on success
+int split_list(char *list, const char **items); //splits a comma separated list in place, returns the count
+char *write_job_file(mix_t *mix); //generates the mix's job file, returns its malloc'd path
+int run_once(const char *mcp, const char *policy, const char *job_file, result_t *r); //runs one MCP over the job file, 0 on success
+void parse_line(const char *line, long long start, double *responses, result_t *r); //picks job starts and dispatches out of one line of output
+double mcp_cpu_time(pid_t pid); //user+system time of the exited but unreaped MCP itself, s
+long mcp_peak_rss(pid_t pid); //VmHWM of the running MCP in kB, -1 once it is gone
+int compare_double(const void *a, const void *b);
+double percentile(double *values, int count, double p); //nearest rank, values sorted
+void report(FILE *out, mix_t *mix, const char *mcp, const char *policy, int run, result_t *r); //prints one run and appends it as a json line
+void json_field(FILE *out, const char *key, const char *value); //writes "key":"value", the value escaped for json
+long long now_ns(void); //CLOCK_MONOTONIC in nanoseconds
+
+const char *kind_names[KINDS] = { "cpu", "io", "short", "mem", "cache", "fsync" };
+mix_t builtin_mixes[] = {
+    { "quick", { 2, 1, 4, 1, 0, 0 }, 1, 64 }, //a few seconds, to check the harness and the MCPs
+    { "mixed", { 3, 3, 8, 2, 1, 1 }, 2, 128 }, //every kind of job, the macro benchmark
+    { "short", { 0, 0, 200, 0, 0, 0 }, 0, 0 }, //spawn and reap cost of many jobs that exit at once, the micro benchmark
+};
+
+const char *bin_dir = "."; //where cpubound and iobound are
+const char *quantum = "100ms"; //-q for part3 and part4
+const char *label = ""; //names the build the results belong to, e.g. a commit
+long long wall_start; //now_ns() of the current run's fork
+
+int main(int argc, char *argv[]) {
+    static struct option long_options[] = {
+        {"repeat", required_argument, NULL, 'r'},
+        {"output", required_argument, NULL, 'o'},
+        {"label", required_argument, NULL, 'l'},
+        {"mcp", required_argument, NULL, 'm'},
+        {"policy", required_argument, NULL, 'P'},
+        {"mix", required_argument, NULL, 'x'},
+        {"quantum", required_argument, NULL, 'q'},
+        {"bin", required_argument, NULL, 'b'},
+        {NULL, 0, NULL, 0}
+    };
+    const char *mcps[MAX_LIST] = { "part4" }, *policies[MAX_LIST] = { "rr" }, *output = "bench-results.jsonl";
+    mix_t mixes[MAX_LIST];
+    int mcp_count = 1, policy_count = 1, mix_count = 0, repeat = 3, opt, usage = 0;
+
+    while (!usage && (opt = getopt_long(argc, argv, "r:o:q:", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 'r':
+            repeat = atoi(optarg);
+            if (repeat <= 0 || repeat > MAX_REPEAT) {
+                fprintf(stderr, "Invalid repeat count '%s'\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        case 'l':
+            label = optarg;
+            break;
+        case 'm':
+            mcp_count = split_list(optarg, mcps);
+            break;
+        case 'P':
+            policy_count = split_list(optarg, policies);
+            break;
+        case 'x':
+            if (mix_count == MAX_LIST || parse_mix(optarg, &mixes[mix_count]) < 0) {
+                fprintf(stderr, "Invalid mix '%s' (quick, mixed, short or cpu=N,io=N,short=N,mem=N,cache=N,fsync=N,"
+                                "seconds=N,mem-mb=N)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            mix_count++;
+            break;
+        case 'q':
+            quantum = optarg;
+            break;
+        case 'b':
+            bin_dir = optarg;
+            break;
+        default:
+            usage = 1; //unknown option or missing argument, stop parsing and print the usage message
+        }
+    }
+    if (usage || optind != argc || mcp_count == 0 || policy_count == 0) {
+        fprintf(stderr, "Usage: %s [-r repeat] [-o results.jsonl] [--label name] [--mcp part1,...,part4]\n"
+                        "       [--policy rr,mlfq,...] [--mix name|spec]... [-q quantum] [--bin dir]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (mix_count == 0) parse_mix("quick", &mixes[mix_count++]);
+
+    FILE *out = fopen(output, "a");
+    if (!out) {
+        perror("fopen");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int x = 0; x < mix_count; x++) {
+        mix_t *mix = &mixes[x];
+        char *job_file = write_job_file(mix);
+        int jobs = 0;
+        for (int k = 0; k < KINDS; k++) jobs += mix->count[k];
+        for (int m = 0; m < mcp_count; m++) {
+            int part4 = strcmp(mcps[m], "part4") == 0;
+            if (!part4 && jobs > PART_MAX_JOBS) {
+                printf("%s: skipped, %s runs at most %d jobs\n", mix->spec, mcps[m], PART_MAX_JOBS);
+                continue;
+            }
+            //only part4 has policies, the other parts run once per mix
+            for (int p = 0; p < (part4 ? policy_count : 1); p++) {
+                const char *policy = part4 ? policies[p] : "-";
+                double makespans[MAX_REPEAT], p99s[MAX_REPEAT];
+                int done = 0;
+                for (int run = 1; run <= repeat; run++) {
+                    result_t r;
+                    if (run_once(mcps[m], policy, job_file, &r) < 0) continue;
+                    r.jobs = jobs;
+                    report(out, mix, mcps[m], policy, run, &r);
+                    makespans[done] = r.makespan;
+                    p99s[done++] = r.p99;
+                }
+                if (done > 1) {
+                    qsort(makespans, done, sizeof(double), compare_double);
+                    qsort(p99s, done, sizeof(double), compare_double);
+                    printf("%s %s %s: median of %d, makespan %.3f s, response p99 %.3f s\n", mix->spec, mcps[m], policy,
+                           done, percentile(makespans, done, 50), percentile(p99s, done, 50));
+                }
+            }
+        }
+        unlink(job_file);
+        free(job_file);
+    }
+    if (fclose(out) != 0) perror("results");
+    return 0;
+}
+
+int parse_mix(const char *spec, mix_t *mix) {
+    //fills mix from a built-in name or "cpu=4,io=4,short=16,mem=2,cache=1,fsync=1,seconds=2", 0 on success
+    //unset kinds default to none, seconds to 2 and mem-mb to 128
+    for (size_t i = 0; i < sizeof(builtin_mixes) / sizeof(builtin_mixes[0]); i++) {
+        if (strcmp(spec, builtin_mixes[i].spec) == 0) {
+            *mix = builtin_mixes[i];
+            return 0;
+        }
+    }
+
+    memset(mix, 0, sizeof(*mix));
+    snprintf(mix->spec, sizeof(mix->spec), "%s", spec);
+    mix->seconds = 2;
+    mix->mem_mb = 128;
+    const char *s = spec;
+    while (*s) {
+        char key[16];
+        int value, used;
+        if (sscanf(s, "%15[a-z-]=%d%n", key, &value, &used) != 2 || value < 0) return -1;
+        int k = 0;
+        while (k < KINDS && strcmp(key, kind_names[k]) != 0) k++;
+        if (k < KINDS) mix->count[k] = value;
+        else if (strcmp(key, "seconds") == 0) mix->seconds = value;
+        else if (strcmp(key, "mem-mb") == 0) mix->mem_mb = value;
+        else return -1;
+        s += used;
+        if (*s == ',') s++;
+        else if (*s) return -1;
+    }
+    int jobs = 0;
+    for (int k = 0; k < KINDS; k++) jobs += mix->count[k];
+    return jobs > 0 ? 0 : -1;
+}
+
+int split_list(char *list, const char **items) {
+    //splits a comma separated list in place, returns the count
+    int count = 0;
+    char *save, *item = strtok_r(list, ",", &save);
+    while (item && count < MAX_LIST) {
+        items[count++] = item;
+        item = strtok_r(NULL, ",", &save);
+    }
+    return count;
+}
+
+char *write_job_file(mix_t *mix) {
+    //generates the mix's job file, returns its malloc'd path
+    //the kinds are interleaved so no policy gets an easy order, and every job is a cpubound or iobound
+    //run, whose start line is what response times are measured by. fsync jobs hardly use the cpu,
+    //so they run for -wall seconds, where -seconds would make their length depend on the disk
+    char *path = strdup("/tmp/mcp-bench-XXXXXX");
+    int fd = path ? mkstemp(path) : -1;
+    FILE *file = fd >= 0 ? fdopen(fd, "w") : NULL;
+    if (!file) {
+        perror("job file");
+        exit(EXIT_FAILURE);
+    }
+    int left[KINDS], total = 0;
+    for (int k = 0; k < KINDS; k++) total += left[k] = mix->count[k];
+    while (total > 0) {
+        for (int k = 0; k < KINDS; k++) {
+            if (left[k] == 0) continue;
+            left[k]--;
+            total--;
+            switch (k) {
+            case KIND_CPU:   fprintf(file, "%s/cpubound -seconds %d\n", bin_dir, mix->seconds); break;
+            case KIND_IO:    fprintf(file, "%s/iobound -seconds %d\n", bin_dir, mix->seconds); break;
+            case KIND_SHORT: fprintf(file, "%s/cpubound -seconds 0\n", bin_dir); break;
+            case KIND_MEM:   fprintf(file, "%s/cpubound -mode membw -memory %d -seconds %d\n", bin_dir, mix->mem_mb, mix->seconds); break;
+            case KIND_CACHE: fprintf(file, "%s/cpubound -mode cache -seconds %d\n", bin_dir, mix->seconds); break;
+            case KIND_FSYNC: fprintf(file, "%s/iobound -mode fsync -wall %d\n", bin_dir, mix->seconds); break;
+            }
+        }
+    }
+    if (fclose(file) != 0) {
+        perror("job file");
+        exit(EXIT_FAILURE);
+    }
+    return path;
+}
+
+int run_once(const char *mcp, const char *policy, const char *job_file, result_t *r) {
+    //runs one MCP over the job file, 0 on success
+    //the MCP and every job write to one pipe, read here as it fills, so a job's first line is timed
+    //within a poll wakeup of being printed
+    char path[256];
+    int out[2];
+    snprintf(path, sizeof(path), "./%s", mcp);
+    if (pipe2(out, O_CLOEXEC) < 0) {
+        perror("pipe2");
+        exit(EXIT_FAILURE);
+    }
+
+    memset(r, 0, sizeof(*r));
+    r->mcp_rss_kb = -1;
+    wall_start = now_ns();
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        exit(EXIT_FAILURE);
+    }
+    if (pid == 0) {
+        int null = open("/dev/null", O_RDONLY);
+        dup2(null, STDIN_FILENO); //part4 would otherwise take control commands from the terminal
+        dup2(out[1], STDOUT_FILENO);
+        if (strcmp(mcp, "part4") == 0) {
+            execl(path, path, "-q", quantum, "--policy", policy, job_file, (char *)NULL);
+        } else if (strcmp(mcp, "part3") == 0) {
+            execl(path, path, "-q", quantum, job_file, (char *)NULL);
+        } else {
+            execl(path, path, job_file, (char *)NULL);
+        }
+        fprintf(stderr, "exec %s: %s\n", path, strerror(errno));
+        _exit(127);
+    }
+    close(out[1]);
+
+    double *responses = malloc(sizeof(double) * (PART_MAX_JOBS + 1));
+    int capacity = PART_MAX_JOBS + 1;
+    char buffer[4096], line[1024];
+    size_t line_length = 0;
+    struct pollfd pfd = { .fd = out[0], .events = POLLIN };
+    while (1) {
+        long rss = mcp_peak_rss(pid);
+        if (rss > r->mcp_rss_kb) r->mcp_rss_kb = rss;
+        if (poll(&pfd, 1, SAMPLE_MS) == 0) continue;
+        ssize_t n = read(out[0], buffer, sizeof(buffer));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break; //every writer, the MCP and its jobs, has exited
+        for (ssize_t i = 0; i < n; i++) {
+            if (buffer[i] != '\n') {
+                if (line_length < sizeof(line) - 1) line[line_length++] = buffer[i];
+                continue;
+            }
+            line[line_length] = '\0';
+            line_length = 0;
+            if (r->started == capacity) {
+                capacity *= 2;
+                responses = realloc(responses, sizeof(double) * capacity);
+            }
+            if (!responses) {
+                perror("malloc");
+                exit(EXIT_FAILURE);
+            }
+            parse_line(line, wall_start, responses, r);
+        }
+    }
+    close(out[0]);
+
+    //WNOWAIT leaves the MCP a zombie whose /proc/[pid]/stat still holds its own final cpu times
+    siginfo_t info;
+    waitid(P_PID, pid, &info, WEXITED | WNOWAIT);
+    r->makespan = (now_ns() - wall_start) / 1e9;
+    r->mcp_cpu = mcp_cpu_time(pid);
+    int status;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "%s %s: MCP failed (status %d)\n", mcp, policy, status);
+        free(responses);
+        return -1;
+    }
+
+    qsort(responses, r->started, sizeof(double), compare_double);
+    r->p50 = percentile(responses, r->started, 50);
+    r->p99 = percentile(responses, r->started, 99);
+    free(responses);
+    return 0;
+}
+
+void parse_line(const char *line, long long start, double *responses, result_t *r) {
+    //picks job starts, the work jobs did and dispatches out of one line of output
+    //part4 logs "MCP: <t> run ..." per dispatch, part3 "MCP: Continued process <pid>";
+    //part1 and part2 start every job once and never switch
+    char kind[16], unit[16];
+    double t;
+    unsigned long long work;
+    if (strncmp(line, "Process: ", 9) == 0 && strstr(line, " - Begining")) {
+        responses[r->started++] = (now_ns() - start) / 1e9;
+    } else if (sscanf(line, "Process: %*d - Finished. %llu %15s %15s", &work, kind, unit) == 3) {
+        char name[32];
+        int k = 0;
+        snprintf(name, sizeof(name), "%s_%s", kind, unit);
+        while (k < r->work_kinds && strcmp(r->work_unit[k], name) != 0) k++;
+        if (k == r->work_kinds && k < MAX_WORK) strcpy(r->work_unit[r->work_kinds++], name);
+        if (k < MAX_WORK) r->work[k] += work;
+    } else if (strncmp(line, "MCP: Continued process", 22) == 0) {
+        r->switches++;
+    } else if (sscanf(line, "MCP: %lf %15s", &t, kind) == 2 && strcmp(kind, "run") == 0) {
+        r->switches++;
+    }
+}
+
+double mcp_cpu_time(pid_t pid) {
+    //user+system time of the exited but unreaped MCP itself, s
+    //utime and stime leave out the children it reaped, which are cutime and cstime
+    char path[64], buffer[1024];
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    ssize_t n = read(fd, buffer, sizeof(buffer) - 1);
+    close(fd);
+    if (n <= 0) return -1;
+    buffer[n] = '\0';
+
+    unsigned long utime, stime;
+    char *close_paren = strrchr(buffer, ')'); //comm may hold spaces
+    if (!close_paren || sscanf(close_paren + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2) {
+        return -1;
+    }
+    return (double)(utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+long mcp_peak_rss(pid_t pid) {
+    //VmHWM of the running MCP in kB, -1 once it is gone
+    char path[64], buffer[2048];
+    snprintf(path, sizeof(path), "/proc/%d/status", pid);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    ssize_t n = read(fd, buffer, sizeof(buffer) - 1);
+    close(fd);
+    if (n <= 0) return -1;
+    buffer[n] = '\0';
+    char *hwm = strstr(buffer, "VmHWM:");
+    return hwm ? atol(hwm + 6) : -1;
+}
+
+int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+double percentile(double *values, int count, double p) {
+    //nearest rank, values sorted
+    if (count == 0) return -1;
+    int rank = (int)(p / 100 * count + 0.999999);
+    if (rank < 1) rank = 1;
+    return values[rank - 1];
+}
+
+void report(FILE *out, mix_t *mix, const char *mcp, const char *policy, int run, result_t *r) {
+    //prints one run and appends it as a json line
+    //-1 marks a figure that couldn't be measured
+    double rate = r->makespan > 0 ? r->switches / r->makespan : 0;
+    printf("%s %s %s run %d: makespan %.3f s, response p50 %.3f s p99 %.3f s (%d/%d started), "
+           "%ld switches (%.1f/s), mcp cpu %.3f s rss %ld kB\n", mix->spec, mcp, policy, run, r->makespan,
+           r->p50, r->p99, r->started, r->jobs, r->switches, rate, r->mcp_cpu, r->mcp_rss_kb);
+    for (int k = 0; k < r->work_kinds; k++) {
+        printf("    %-12s %14llu (%.0f/s of makespan)\n", r->work_unit[k], r->work[k], r->work[k] / r->makespan);
+    }
+    fflush(stdout);
+
+    //every string goes through json_field: --label comes from the user (git describe by default), and a
+    //quote or backslash in it would otherwise break the whole results file
+    fputc('{', out);
+    json_field(out, "label", label);
+    fprintf(out, ",\"time\":%ld,", (long)time(NULL));
+    json_field(out, "mix", mix->spec);
+    fputc(',', out);
+    json_field(out, "mcp", mcp);
+    fputc(',', out);
+    json_field(out, "policy", policy);
+    fputc(',', out);
+    json_field(out, "quantum", quantum);
+    fprintf(out, ",\"run\":%d,\"jobs\":%d,\"started\":%d,\"makespan_s\":%.6f,\"response_p50_s\":%.6f,"
+                 "\"response_p99_s\":%.6f,\"switches\":%ld,\"switches_per_s\":%.3f,\"mcp_cpu_s\":%.3f,"
+                 "\"mcp_rss_kb\":%ld,\"work\":{", run, r->jobs, r->started, r->makespan, r->p50, r->p99,
+            r->switches, rate, r->mcp_cpu, r->mcp_rss_kb);
+    for (int k = 0; k < r->work_kinds; k++) {
+        if (k) fputc(',', out);
+        //the unit is the key, the count is a number
+        json_field(out, r->work_unit[k], NULL);
+        fprintf(out, "%llu", r->work[k]);
+    }
+    fprintf(out, "}}\n");
+    fflush(out);
+}
+
+void json_field(FILE *out, const char *key, const char *value) {
+    //writes "key":"value" with quotes, backslashes and control characters escaped, or just "key": when
+    //value is NULL so a number can follow
+    const char *strings[2] = { key, value };
+    for (int i = 0; i < 2 && strings[i]; i++) {
+        fputc('"', out);
+        for (const unsigned char *c = (const unsigned char *)strings[i]; *c; c++) {
+            if (*c == '"' || *c == '\\') fprintf(out, "\\%c", *c);
+            else if (*c < 0x20) fprintf(out, "\\u%04x", *c);
+            else fputc(*c, out);
+        }
+        fputs(i ? "\"" : "\":", out);
+    }
+}
+
+long long now_ns(void) {
+    //CLOCK_MONOTONIC in nanoseconds
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
@@ -0,0 +1,106 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "control.h"
+
+//created for mcpctl
+int send_command(int fd, FILE *replies, const char *line); //sends one command and copies its reply, 0 if it ended with ok
+
+int main(int argc, char *argv[]) {
+    static struct option long_options[] = {
+        {"socket", required_argument, NULL, 's'},
+        {NULL, 0, NULL, 0}
+    };
+    const char *path = NULL;
+    int opt, usage = 0;
+
+    //+: options end at the command, a job line has options of its own
+    while (!usage && (opt = getopt_long(argc, argv, "+s:", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 's':
+            path = optarg;
+            break;
+        default:
+            usage = 1; //unknown option or missing argument, stop parsing and print the usage message
+        }
+    }
+    if (usage) {
+        fprintf(stderr, "Usage: %s [-s socket] [status | submit <job line> | cancel <job> | tail <job> | stream | shutdown | quit]\n"
+                        "       without a command, every line of stdin is sent as one\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (!path) path = default_socket();
+
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        fprintf(stderr, "mcpctl: no MCP listening on %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+    FILE *replies = fdopen(dup(fd), "r");
+    if (!replies) {
+        perror("fdopen");
+        exit(EXIT_FAILURE);
+    }
+
+    //the command line joined back into one command, so the job line of submit needs no quoting
+    char line[CONTROL_MAX];
+    int failed = 0;
+    if (optind < argc) {
+        size_t length = 0;
+        line[0] = '\0';
+        for (int i = optind; i < argc; i++) {
+            length += snprintf(line + length, sizeof(line) - length, "%s%s", i > optind ? " " : "", argv[i]);
+            if (length >= sizeof(line)) {
+                fprintf(stderr, "mcpctl: command longer than %d bytes\n", CONTROL_MAX - 1);
+                exit(EXIT_FAILURE);
+            }
+        }
+        failed = send_command(fd, replies, line) != 0;
+        if (!failed && strcmp(line, "stream") == 0) {
+            //the log follows until the MCP exits or drops us
+            int c;
+            while ((c = getc(replies)) != EOF) putchar(c);
+        }
+    } else {
+        //e.g. sed 's/^/submit /' input.txt | mcpctl submits a whole job file, printing one serial per job
+        while (fgets(line, sizeof(line), stdin)) {
+            line[strcspn(line, "\n")] = '\0';
+            if (line[0] == '\0') continue;
+            if (send_command(fd, replies, line) != 0) failed = 1;
+        }
+    }
+    fclose(replies);
+    close(fd);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+int send_command(int fd, FILE *replies, const char *line) {
+    //sends one command and copies its reply to stdout up to the closing "ok" or "error" line
+    //"ok <serial>" from submit prints the serial, errors go to stderr
+    char reply[CONTROL_MAX + 256];
+    size_t length = strlen(line);
+    if (write(fd, line, length) != (ssize_t)length || write(fd, "\n", 1) != 1) {
+        perror("write");
+        return -1;
+    }
+    while (fgets(reply, sizeof(reply), replies)) {
+        if (strncmp(reply, "ok", 2) == 0 && (reply[2] == '\n' || reply[2] == ' ')) {
+            if (reply[2] == ' ') fputs(reply + 3, stdout);
+            return 0;
+        }
+        if (strncmp(reply, "error ", 6) == 0) {
+            fprintf(stderr, "mcpctl: %s", reply + 6);
+            return 1;
+        }
+        fputs(reply, stdout);
+    }
+    fprintf(stderr, "mcpctl: the MCP closed the connection\n");
+    return -1;
+}
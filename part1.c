@@ -59,7 +59,7 @@ int read_input_file(const char *filename, char lines[][MAX_LINE]) {
         exit(EXIT_FAILURE);
     }
     int count = 0;
-    while (fgets(lines[count], MAX_LINE, file) != NULL && count < MAX_CMDS) {
+    while (count < MAX_CMDS && fgets(lines[count], MAX_LINE, file) != NULL) {
         trim_newline(lines[count]);
         count++;
     }
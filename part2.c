@@ -2,8 +2,11 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/wait.h>
 
+#include "barrier.h"
+
 #define MAX_LINE 1024
 #define MAX_ARGS 100
 #define MAX_CMDS 100
@@ -16,13 +19,14 @@ void wait_for_children(pid_t *pids, int count);
 
 //created for part2
 void setup_sigusr1_blocking(sigset_t *sigset); //sets up signal blocking so child processes can wait for SIGUSR1
-pid_t fork_child_process(char *line, sigset_t *sigset); //forks a new child process and has it wait for SIGUSR1 before calling execvp
-void signal_children(pid_t *pids, int count); //sends SIGUSR1, SIGSTOP, and SIGCONT to all child processes
+pid_t fork_child_process(char *line, sigset_t *sigset, int *barrier); //forks a new child process and has it wait for SIGUSR1 before calling execvp
+void signal_children(pid_t *pids, int count, int *barrier); //sends SIGUSR1, SIGSTOP, and SIGCONT to all child processes
 
 int main(int argc, char *argv[]) {
     char lines[MAX_CMDS][MAX_LINE]; //stores lines read from input.txt
     pid_t pids[MAX_CMDS];           //stores child process PIDs
     sigset_t sigset;                //signal set for SIGUSR1
+    int barrier[2];                 //pipe children report to while launching
 
     setup_sigusr1_blocking(&sigset); //block SIGUSR1 so that child processes can wait on it using sigwait()
 
@@ -33,14 +37,15 @@ int main(int argc, char *argv[]) {
     const char *filename = argv[1];
     int line_count = read_input_file(filename, lines); //store inputs in lines and get count
     int pid_count = 0;
+    setup_launch_barrier(barrier);
 
     //fork a child process for each command
     for (int i = 0; i < line_count; i++) {
         if (strlen(lines[i]) == 0) continue; //kip empty lines
-        pids[pid_count++] = fork_child_process(lines[i], &sigset);
+        pids[pid_count++] = fork_child_process(lines[i], &sigset, barrier);
     }
 
-    signal_children(pids, pid_count); //signal the child processes to start and control their execution
+    signal_children(pids, pid_count, barrier); //signal the child processes to start and control their execution
     wait_for_children(pids, pid_count); //wait for all child processes to terminate
     printf("MCP: All processes have finished.\n");
 
@@ -59,7 +64,7 @@ void setup_sigusr1_blocking(sigset_t *sigset) {
     }
 }
 
-pid_t fork_child_process(char *line, sigset_t *sigset) {
+pid_t fork_child_process(char *line, sigset_t *sigset, int *barrier) {
     char *args[MAX_ARGS];
     parse_command(line, args);
 
@@ -71,6 +76,8 @@ pid_t fork_child_process(char *line, sigset_t *sigset) {
     } else if (pid == 0) {
         //child process waits for SIGUSR1 before executing the command
         printf("Child %d waiting for SIGUSR1...\n", getpid());
+        close(barrier[0]);
+        if (write(barrier[1], "p", 1) != 1) exit(EXIT_FAILURE); //parked: SIGUSR1 is blocked, so it stays pending until sigwait()
         int sig;
         sigwait(sigset, &sig); //wait until SIGUSR1 is received
 
@@ -85,8 +92,10 @@ pid_t fork_child_process(char *line, sigset_t *sigset) {
     return pid;
 }
 
-void signal_children(pid_t *pids, int count) {
-    sleep(1); //allow time for children to block on sigwait()
+void signal_children(pid_t *pids, int count, int *barrier) {
+    //each phase waits for the kernel to report the children ready instead of sleeping for a second
+    close(barrier[1]); //only the children hold the write end now, so the pipe hits EOF once they have all exec'd
+    wait_at_barrier(barrier[0], count); //every child has written its byte and blocked SIGUSR1 is waiting for sigwait()
 
     //send SIGUSR1 to all children to wake them up and let them exec
     printf("\nMCP: Sending SIGUSR1 to all children...\n");
@@ -94,7 +103,8 @@ void signal_children(pid_t *pids, int count) {
         kill(pids[i], SIGUSR1);
     }
 
-    sleep(1); //allow processes to begin executing
+    wait_at_barrier(barrier[0], 0); //exec closes each child's close-on-exec write end, a failed exec closes it on exit
+    close(barrier[0]);
 
     //send SIGSTOP to suspend all children
     printf("\nMCP: Sending SIGSTOP to all children...\n");
@@ -102,7 +112,7 @@ void signal_children(pid_t *pids, int count) {
         kill(pids[i], SIGSTOP);
     }
 
-    sleep(1); //pause before resuming
+    confirm_stopped(pids, count);
 
     //send SIGCONT to resume all children
     printf("\nMCP: Sending SIGCONT to all children...\n");
@@ -126,7 +136,7 @@ int read_input_file(const char *filename, char lines[][MAX_LINE]) {
         exit(EXIT_FAILURE);
     }
     int count = 0;
-    while (fgets(lines[count], MAX_LINE, file) != NULL && count < MAX_CMDS) {
+    while (count < MAX_CMDS && fgets(lines[count], MAX_LINE, file) != NULL) {
         trim_newline(lines[count]);
         count++;
     }
@@ -2,11 +2,24 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/wait.h>
+#include <sys/time.h>
+#include <stdatomic.h>
+
+#include "barrier.h"
+#include "duration.h"
 
 #define MAX_LINE 1024
 #define MAX_ARGS 100
 #define MAX_CMDS 100
+#define LOG_CAPACITY 256 //events alarm_handler can log before main drains them, a power of two
+
+enum { LOG_STOP, LOG_CONT };
+typedef struct {
+    int type;
+    pid_t pid;
+} log_event_t;
 
 //global variables
 char lines[MAX_CMDS][MAX_LINE];
@@ -14,6 +27,9 @@ pid_t pids[MAX_CMDS];
 int is_finished[MAX_CMDS] = {0};
 int count = 0;
 int current = 0;
+log_event_t log_ring[LOG_CAPACITY];
+atomic_uint log_head = 0, log_tail = 0; //alarm_handler only moves head, main only moves tail
+atomic_uint log_dropped = 0;
 
 //created for part1
 void trim_newline(char *str);
@@ -22,29 +38,43 @@ void parse_command(char *line, char **args);
 
 //created for part2
 void setup_sigusr1_blocking(sigset_t *sigset); //sets up signal blocking so child processes can wait for SIGUSR1
-pid_t fork_child_process(char *line, sigset_t *sigset); //forks a new child process and has it wait for SIGUSR1 before calling execvp
-void signal_children(pid_t *pids, int count); //sends SIGUSR1, SIGSTOP, and SIGCONT to all child processes
+pid_t fork_child_process(char *line, sigset_t *sigset, int *barrier); //forks a new child process and has it wait for SIGUSR1 before calling execvp
+void signal_children(pid_t *pids, int count, int *barrier); //sends SIGUSR1, SIGSTOP, and SIGCONT to all child processes
 
 //created for part3
 void alarm_handler(int signum);
+void start_quantum_timer(long long quantum); //periodic ITIMER_REAL, 0 cancels it
+void log_event(int type, pid_t pid); //records an event from alarm_handler, async-signal-safe
+void log_drain(void); //prints the events logged so far, outside signal context
 
 int main(int argc, char *argv[]) {
 
     sigset_t sigset;
+    int barrier[2]; //pipe children report to while launching
+    long long quantum = 1000000000LL; //1 second unless -q is given
+    const char *program = argv[0];
     setup_sigusr1_blocking(&sigset);  //setup signal blocking so child processes can use sigwait() to pause before exec
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <input_file>\n", argv[0]);
+    if (argc == 4 && strcmp(argv[1], "-q") == 0) {
+        quantum = parse_duration(argv[2]);
+        argv += 2;
+        argc -= 2;
+    }
+    if (argc != 2 || quantum <= 0) {
+        fprintf(stderr, "Usage: %s [-q quantum] <input_file>\n", program);
         exit(EXIT_FAILURE);
     }
     const char *filename = argv[1];
-    int line_count = read_input_file(filename, lines); //store inputs in lines and get count
+    count = read_input_file(filename, lines); //store inputs in lines and get count
 
+    setup_launch_barrier(barrier);
+    int forked = 0;
     for (int i = 0; i < count; i++) {
         if (strlen(lines[i]) == 0) continue;
-        pids[i] = fork_child_process(lines[i], &sigset); //fork a child process for each command and store their PIDs
+        pids[forked++] = fork_child_process(lines[i], &sigset, barrier); //fork a child process for each command and store their PIDs
     }
+    count = forked; //empty lines have no child, and the barrier waits for exactly this many reports
 
-    signal_children(pids, count); //send SIGUSR1 to children to unblock them so they exec(), then SIGSTOP to pause them
+    signal_children(pids, count, barrier); //send SIGUSR1 to children to unblock them so they exec(), then SIGSTOP to pause them
 
     //SIGALRM handler
     struct sigaction sa;
@@ -53,7 +83,7 @@ int main(int argc, char *argv[]) {
     sigemptyset(&sa.sa_mask); //don't block any signals during handler
     sigaction(SIGALRM, &sa, NULL); //register handler
 
-    alarm(1); //start scheduler
+    start_quantum_timer(quantum); //start scheduler
 
     //monitor child processes
     while (1) {
@@ -71,6 +101,7 @@ int main(int argc, char *argv[]) {
             }
         }
 
+        log_drain();
         if (all_done) break; //break loop once all children have finished
         pause(); //wait for next SIGALRM
     }
@@ -81,30 +112,68 @@ int main(int argc, char *argv[]) {
 }
 
 void alarm_handler(int signum) {
+    (void)signum;
     if (count == 0) return;
 
     //stop the current process if it's still running
     if (!is_finished[current]) {
         kill(pids[current], SIGSTOP);
-        printf("MCP: Stopped process %d\n", pids[current]);
+        log_event(LOG_STOP, pids[current]);
     }
 
     //find the next active (unfinished) process
-    int next = (current + 1) % count;
-    while (is_finished[next]) {
+    //wrapping back to current is fine when it is the only one left, it was just stopped and resumes below
+    int next = current;
+    do {
         next = (next + 1) % count;
-        if (next == current) {
-            //all processes are finished or nothing left to schedule
-            alarm(0); //cancel further alarms
-            return;
-        }
+    } while (is_finished[next] && next != current);
+    if (is_finished[next]) {
+        //all processes are finished or nothing left to schedule
+        start_quantum_timer(0); //cancel further alarms
+        return;
     }
 
     current = next;
     kill(pids[current], SIGCONT);
-    printf("MCP: Continued process %d\n", pids[current]);
+    log_event(LOG_CONT, pids[current]);
+}
+
+void log_event(int type, pid_t pid) {
+    //records an event from alarm_handler, async-signal-safe
+    //printf there could deadlock on stdout's lock if the alarm interrupted main's own printf
+    unsigned int head = atomic_load(&log_head);
+    if (head - atomic_load(&log_tail) >= LOG_CAPACITY) {
+        atomic_fetch_add(&log_dropped, 1); //main is behind, keep the scheduler going and count the loss
+        return;
+    }
+    log_ring[head % LOG_CAPACITY].type = type;
+    log_ring[head % LOG_CAPACITY].pid = pid;
+    atomic_store(&log_head, head + 1);
+}
+
+void log_drain(void) {
+    //prints the events logged so far, outside signal context
+    unsigned int tail = atomic_load(&log_tail);
+    for (; tail != atomic_load(&log_head); tail++) {
+        log_event_t *e = &log_ring[tail % LOG_CAPACITY];
+        printf("MCP: %s process %d\n", e->type == LOG_STOP ? "Stopped" : "Continued", e->pid);
+        atomic_store(&log_tail, tail + 1);
+    }
+    unsigned int dropped = atomic_exchange(&log_dropped, 0);
+    if (dropped > 0) printf("MCP: log dropped %u events\n", dropped);
+}
 
-    alarm(1); //schedule the next alarm
+void start_quantum_timer(long long quantum) {
+    //periodic ITIMER_REAL: the kernel re-arms it on every expiry, so slices don't drift
+    //by however long alarm_handler took, which re-arming alarm(1) by hand did
+    struct itimerval itv;
+    itv.it_value.tv_sec = quantum / 1000000000LL;
+    itv.it_value.tv_usec = (quantum % 1000000000LL) / 1000;
+    if (quantum > 0 && itv.it_value.tv_sec == 0 && itv.it_value.tv_usec == 0) {
+        itv.it_value.tv_usec = 1; //sub-microsecond quanta round up instead of disarming
+    }
+    itv.it_interval = itv.it_value;
+    setitimer(ITIMER_REAL, &itv, NULL);
 }
 
 
@@ -121,7 +190,7 @@ void setup_sigusr1_blocking(sigset_t *sigset) {
 }
 
 
-pid_t fork_child_process(char *line, sigset_t *sigset) {
+pid_t fork_child_process(char *line, sigset_t *sigset, int *barrier) {
     char *args[MAX_ARGS];
     parse_command(line, args);
 
@@ -133,6 +202,8 @@ pid_t fork_child_process(char *line, sigset_t *sigset) {
     } else if (pid == 0) {
         //child process waits for SIGUSR1 before executing the command
         printf("Child %d waiting for SIGUSR1...\n", getpid());
+        close(barrier[0]);
+        if (write(barrier[1], "p", 1) != 1) exit(EXIT_FAILURE); //parked: SIGUSR1 is blocked, so it stays pending until sigwait()
         int sig;
         sigwait(sigset, &sig); //wait until SIGUSR1 is received
 
@@ -148,8 +219,10 @@ pid_t fork_child_process(char *line, sigset_t *sigset) {
     return pid;
 }
 
-void signal_children(pid_t *pids, int count) {
-    sleep(1); //allow time for children to block on sigwait()
+void signal_children(pid_t *pids, int count, int *barrier) {
+    //each phase waits for the kernel to report the children ready instead of sleeping for a second
+    close(barrier[1]); //only the children hold the write end now, so the pipe hits EOF once they have all exec'd
+    wait_at_barrier(barrier[0], count); //every child has written its byte and blocked SIGUSR1 is waiting for sigwait()
 
     //send SIGUSR1 to all children to wake them up and let them exec
     printf("\nMCP: Sending SIGUSR1 to all children...\n");
@@ -157,7 +230,8 @@ void signal_children(pid_t *pids, int count) {
         kill(pids[i], SIGUSR1);
     }
 
-    sleep(1); //allow processes to begin executing
+    wait_at_barrier(barrier[0], 0); //exec closes each child's close-on-exec write end, a failed exec closes it on exit
+    close(barrier[0]);
 
     //send SIGSTOP to suspend all children
     printf("\nMCP: Sending SIGSTOP to all children...\n");
@@ -165,7 +239,7 @@ void signal_children(pid_t *pids, int count) {
         kill(pids[i], SIGSTOP);
     }
 
-    sleep(1); //pause before resuming
+    confirm_stopped(pids, count);
 
     //send SIGCONT to resume all children
     printf("\nMCP: Sending SIGCONT to all children...\n");
@@ -189,7 +263,7 @@ int read_input_file(const char *filename, char lines[][MAX_LINE]) {
         exit(EXIT_FAILURE);
     }
     int count = 0;
-    while (fgets(lines[count], MAX_LINE, file) != NULL && count < MAX_CMDS) {
+    while (count < MAX_CMDS && fgets(lines[count], MAX_LINE, file) != NULL) {
         trim_newline(lines[count]);
         count++;
     }
@@ -1,99 +1,705 @@
+#define _GNU_SOURCE //sched_setaffinity and the CPU_SET macros
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <signal.h>
+#include <errno.h>
+#include <getopt.h>
+#include <sched.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
 #include <sys/types.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/sched.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <limits.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/genetlink.h>
+#include <linux/taskstats.h>
 #include <time.h>
 #include <fcntl.h>
+#include <stdarg.h>
+#include <sys/un.h>
+#include "histogram.h"
+#include "control.h"
+#include "duration.h"
 
-#define MAX_CMDS 100
-#define MAX_LINE 1024
-#define MAX_ARGS 100
-#define TIME_SLICE 1 // seconds
+#define GATE_ARG "--mcp-gate" //argv[1] of a job's launcher, the MCP re-executed to wait for the job's first slice
+#define SELF_EXE "/proc/self/exe" //the MCP's own binary, in the child as much as in the MCP
+#define TIME_SLICE 1 // seconds, default quantum when -q is not given
+#define NSEC_PER_SEC 1000000000LL
+#define MAX_EVENTS 64
+#define MLFQ_LEVELS 4 //level n runs for quantum << n
+#define MLFQ_BOOST 5 // seconds between priority boosts, default for --boost
+#define DEFAULT_WEIGHT 100 //weight= of a job that doesn't set one
+#define STRIDE1 (1 << 20) //stride of a job with weight 1
+#define CFS_LATENCY 4 //quanta in which cfs tries to run every waiting job once
+#define HISTORY_SIZE 64 //distinct commands srtf remembers run times for
+#define ADMIT_WINDOW 256 //default -w, most jobs spawned and not yet reaped at once
+#define LOG_CAPACITY 4096 //events the log ring holds, a power of two
+#define TRACE_MAGIC "MCPTRACE"
+#define TRACE_VERSION 1
+#define TASKSTATS_BATCH 64 //taskstats requests per sendmsg, small enough that the replies fit the socket buffer
+#define MAX_CLIENTS 64 //daemon connections open at once
+#define EV_CLIENT 0x40000000 //epoll tag of daemon client i is EV_CLIENT | i, above any timer's tag
+#define REPLY_BUFFER (1 << 20) //bytes of replies a client may leave unread before it is cut off
+#define EV_OUTPUT 0x20000000 //epoll tag of a job's stdout pipe is EV_OUTPUT | pid, pids stay below 1 << 22
+#define EV_STDERR 0x10000000 //added for its stderr pipe
+#define OUTPUT_CHUNK (1 << 20) //most bytes one splice moves from a job's pipe to its file
+#define TAIL_BYTES 4096 //how much of the end of each output file the tail command shows
+#define DAG_RETAIN 1024 //finished names a daemon keeps for later after= once no job is after them
+#define ADAPT_SAMPLES 32 //waits between two adjustments of the adaptive quantum
+#define ADAPT_MIN 1000000LL //ns, shortest quantum --adaptive picks
+#define ADAPT_MAX (10 * NSEC_PER_SEC) //ns, longest
+#define ADAPT_STEP 4 //most the quantum grows or shrinks by in one adjustment
 
 //created for part1
 void trim_newline(char *str);
-int read_input_file(const char *filename, char lines[][MAX_LINE]);
-void parse_command(char *line, char **args);
-
-//created for part2
-void setup_sigusr1_blocking(sigset_t *sigset); //sets up signal blocking so child processes can wait for SIGUSR1
-pid_t fork_child_process(char *line, sigset_t *sigset); //forks a new child process and has it wait for SIGUSR1 before calling execvp
+char **parse_command(char *line); //splits a line into a malloc'd, NULL-terminated argument vector
 
 //created for part4
-void print_proc_stats(pid_t pid);
-void handle_alarm(int sig);
+typedef struct {
+    char comm[256];
+    unsigned long utime, stime; //clock ticks
+    long rss_kb;
+    long long read_bytes, write_bytes; //storage i/o, -1 when the backend doesn't report it
+} proc_stats_t;
+
+const char *skip_fields(const char *s, int count); //moves past count space separated fields
+unsigned long parse_ulong(const char **s); //parses the decimal number at *s and moves *s past it
+int open_proc_file(pid_t pid, const char *name); //opens /proc/[pid]/name close-on-exec, -1 if it can't
+int taskstats_open(void); //opens the taskstats netlink socket and looks up its family, -1 if the kernel has none
+void cgroup_setup(void); //creates the MCP's cgroup under the delegated --cgroup directory
+void cgroup_teardown(void); //removes the MCP's cgroup and any job cgroups left in it
+int cgroup_write(int dir_fd, const char *file, const char *value); //writes value to a control file of the cgroup open as dir_fd, 0 on success
+void schedule_slot(int slot, int expired); //stops the slot's process and continues the next waiting one on it
+struct process *pick_next(int slot); //takes the next process off the slot's run queue, stealing from the busiest slot if it is empty
+void kick_idle_slots(void); //gives every idle slot a chance to steal work that was just queued
+void boost_priorities(void); //mlfq: moves every waiting process back to the top level
+void pin_to_slot(pid_t pid, int slot); //restricts pid to the slot's core when --pin is set
+long long parse_size(const char *str); //parses "512M", "2G", "64k" into bytes, -1 if invalid
+void admit_jobs(void); //spawns jobs from the job file while the window and budgets allow
+int within_budget(void); //whether the memory and cpu budgets leave room for another job
+long long now_ns(void); //CLOCK_MONOTONIC in nanoseconds
+void print_summary(void); //makespan and mean turnaround, to compare policies
+
+//event loop
+enum { EV_SIGNAL, EV_CONTROL, EV_BOOST, EV_ARRIVE, EV_LISTEN, EV_LIMIT, EV_TIMER }; //tags stored in epoll_event.data.u32, slot i's timer is EV_TIMER + i
+void setup_slots(void); //allocates the slots and picks the core each one is pinned to
+void setup_event_loop(void); //creates the epoll instance, the SIGCHLD signalfd and one quantum timerfd per slot
+void arm_arrival(long long when); //wakes the loop when the next job of the file is submitted
+void arm_timer(int slot, long long quantum, int expired); //starts a new time slice on the slot's timerfd
+void handle_timer_event(int slot); //the slot's time slice expired
+void handle_signal_event(void); //SIGCHLD arrived, reap every exited child
+void handle_control_event(void); //a command line arrived on stdin
+void handle_output_event(unsigned tag); //a job wrote to its stdout or stderr pipe
+void run_event_loop(void); //dispatches events until every process has finished
+int more_jobs(void); //whether jobs are left to admit: the rest of the file, ready ones or daemon submissions
 
+//daemon, selected with --listen (mcpd listens unless told otherwise): jobs and commands arrive on a unix socket
 typedef struct {
+    int fd; //-1 for a free entry
+    char buffer[CONTROL_MAX]; //the start of a command line that hasn't ended yet
+    size_t length;
+    char *pending; //replies its socket hasn't taken yet, sent as it becomes writable, malloc'd
+    size_t pending_length, pending_capacity;
+    int watching; //sent "stream": it only reads from then on, and what else it sends is ignored
+    int streaming; //the drain thread copies every log line to it, set once its earlier replies are all sent
+} client_t;
+
+void setup_listener(void); //binds the --listen socket and adds it to the event loop
+void stop_listening(void); //closes and removes the socket, the loop ends once the jobs left have finished
+void handle_listen_event(void); //accepts waiting clients
+void handle_client_event(int index, unsigned events); //sends a client's pending replies and runs the complete command lines it sent
+void client_close(int index); //drops a client, streaming or not
+void client_flush(int index); //sends what the socket takes of a client's pending replies
+void client_stream(int index); //hands a watching client to the drain thread
+void run_command(char *line, int client); //runs a control command from stdin (client -1) or a daemon client
+void reply(int client, const char *format, ...); //a line of output for whoever sent the command
+void submit_job(char *line, int client); //queues a job line for admission, replying with its serial
+void cancel_job(long serial, int client); //kills a job, or skips it if it hasn't started
+void cancel_pending(void); //quit: closes the job file and marks every job that hasn't started to be skipped
+struct process *find_job(long serial); //unfinished job with that serial, wherever it waits
+void stream_line(const char *line); //drain thread: copies a log line to every streaming client
+void job_warning(const char *format, ...); //a problem with a job line, for whoever submitted it
+
+//simulation, selected with --simulate: the same scheduler core in virtual time, with job profiles instead of processes
+enum { SIM_TIMER, SIM_BURST, SIM_IO, SIM_ARRIVE, SIM_BOOST }; //sim_event_t.type
+typedef struct {
+    long long time; //virtual ns
+    long order; //push order, breaks ties so every run of a workload makes the same decisions
+    int type;
+    int slot; //SIM_TIMER
+    pid_t pid; //SIM_BURST and SIM_IO, looked up again so events left over from a finished job are skipped
+    unsigned seq; //SIM_TIMER and SIM_BURST are stale unless it matches the slot's or the job's current seq
+} sim_event_t;
+
+void setup_simulation(void); //slots and virtual clock for --simulate, in place of setup_event_loop
+void run_simulation(void); //replays events in virtual time until every job has finished
+void sim_push(int type, long long time, int slot, pid_t pid, unsigned seq); //schedules a virtual event
+int sim_pop(sim_event_t *e); //takes the earliest event off the heap, 0 if it is empty
+
+typedef struct process {
     pid_t pid;
-    char cmd[MAX_LINE];
-    int finished;
+    char *cmd; //command line without job options, malloc'd
+    long long quantum; //per-job time slice in ns, 0 uses default_quantum
+    int weight; //cpu share for lottery, stride and cfs, DEFAULT_WEIGHT unless weight= is given
+    int slot; //slot currently running this process, -1 while stopped
+    int last_slot; //slot it last ran on
+    int queued_on; //slot whose run queue holds it, -1 while running or finished
+    int level; //mlfq priority level, 0 is highest
+    unsigned long slice_cpu; //utime+stime ticks when the current slice started
+    long long slice_start; //now_ns() when the current slice started
+    long long cpu_ns; //cpu time used so far
+    long rss_kb; //resident set size at the last /proc sample, summed into live_rss_kb
+    long long io_bytes; //storage bytes read and written at the last bulk sample, -1 if unknown
+    int stat_fd, statm_fd; //open /proc/[pid]/stat and statm, -1 until the first sample
+    long serial; //1-based position among jobs read or submitted, names the job's cgroup and is its id for cancel
+    int cgroup_fd, freeze_fd; //the job's cgroup directory and its cgroup.freeze with --cgroup, -1 otherwise
+    int gate_fd; //write end of the pipe its launcher waits on, -1 once its first slice has released it
+    double cpu_max; //cpumax= share of one cpu for cpu.max, 0 for no limit
+    long long mem_max; //memmax= bytes for memory.max, 0 for no limit
+    long long hint; //srtf: expected cpu time from a -seconds argument, 0 if none
+    long long key; //order in the slot's tree: remaining time (srtf), pass (stride) or vruntime (cfs)
+    long long submitted_at, spawned_at, finished_at; //now_ns() stamps for the turnaround summary
+    long long arrive; //arrive= delay after the start of the batch before the job is submitted, 0 for none
+    long long *profile; //simulate: burst lengths in ns, cpu bursts positive and i/o waits negative, malloc'd
+    int profile_length;
+    long long profile_total; //simulate: bursts counting repeats, profile_length times the xN
+    long long burst; //simulate: index of the current burst counting repeats, -1 before the first slice
+    long long burst_left; //simulate: ns left of a cpu burst, absolute end of an i/o wait
+    long long cpu_since; //simulate: when the cpu burst last started progressing, -1 while it isn't
+    long long sim_cpu; //simulate: cpu time used by bursts that stopped progressing
+    unsigned sim_seq; //simulate: bumped to cancel the pending SIM_BURST
+    struct process *rq_prev, *rq_next; //links in a list run queue
+    struct process *rb_parent, *rb_left, *rb_right; //links in an ordered run queue
+    int rb_red;
+    struct process *job_prev, *job_next; //links in the list of live jobs, job_next also links the ready list
+    int failed; //exited non-zero, was killed, couldn't run or was skipped
+    struct dag_node *node; //name=: its entry in the name table, NULL for unnamed jobs
+    struct dag_node **after; //after=: the jobs it runs after, malloc'd
+    int after_count;
+    int waiting; //after= jobs that haven't finished yet, it is held until none are left
+    int after_failed; //one of them failed, it is skipped instead of run
+    int cancelled; //cancelled before it started, it is skipped instead of run
+    int out_fd[2]; //--output: read ends of its stdout and stderr pipes, -1 once closed
+    int file_fd[2]; //the job-N.out and job-N.err files they are spliced into
+    long long out_bytes[2]; //bytes moved so far
+    long long rank; //critical path: its estimate plus the longest rank among the jobs after it
+    long long cpu_limit; //cpu= ns of cpu time, 0 for no limit
+    long long rss_limit; //rss= bytes resident
+    long long wall_limit; //wall= ns since it was spawned
+    long nofile_limit; //nofile= open files, RLIMIT_NOFILE
+    int overrun_demote; //overrun=demote: going over cpu= or wall= demotes it instead of killing it
+    int demoted; //over cpu= or wall= with overrun=demote, it waits in background and runs only on idle slots
+    int killed; //killed over a limit, waiting to be reaped
+    long long stopped_at; //now_ns() when it last lost its slot or was queued, for the waits --adaptive measures
+    long long stopped_quantum; //default_quantum then, what the wait is measured against
+    long long burst_ns; //--adaptive: moving average of the cpu it used in slices it blocked in, 0 while it runs through them
 } process_t;
 
-process_t processes[MAX_CMDS];
-int proc_count = 0;
-int current = -1;
+typedef struct {
+    process_t *head, *tail;
+    int length;
+} runqueue_t;
 
-int main(int argc, char *argv[]) {
-    char lines[MAX_CMDS][MAX_LINE];
-    sigset_t sigset;
-    struct sigaction sa;
+typedef struct {
+    process_t *root;
+} rbtree_t;
 
-    setup_sigusr1_blocking(&sigset);
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <input_file>\n", argv[0]);
-        exit(EXIT_FAILURE);
-    }
-    const char *filename = argv[1];
-    int line_count = read_input_file(filename, lines); //store inputs in lines and get count
+typedef struct {
+    process_t *running; //NULL when idle
+    runqueue_t rq[MLFQ_LEVELS]; //list policies: round-robin queues, only mlfq uses more than level 0
+    rbtree_t tree; //ordered policies: waiting processes sorted by key
+    int queued; //processes waiting in rq or tree
+    long weight_sum; //total weight of the waiting processes, the lottery's ticket count
+    long long min_key; //key of the last process picked from tree, where new and migrated processes start
+    int cpu; //core the slot's processes are pinned to with --pin
+    int timer_fd;
+    unsigned timer_seq; //simulate: bumped to cancel the pending SIM_TIMER
+    long long slice_deadline; //absolute CLOCK_MONOTONIC end of the running slice
+} slot_t;
 
-    for (int i = 0; i < line_count; ++i) {
-        if (strlen(lines[i]) == 0) continue;
-        fork_child_process(lines[i], &sigset);
-    }
+typedef struct {
+    const char *name;
+    int preemptive; //0: a running process keeps its slot until it exits
+    void (*enqueue)(slot_t *sl, process_t *p); //makes p wait on sl
+    void (*dequeue)(slot_t *sl, process_t *p); //removes a waiting p from sl
+    process_t *(*pick_next)(slot_t *sl); //the waiting process sl should run next, left queued
+    process_t *(*steal)(slot_t *sl); //the waiting process an idle slot should take from sl, left queued
+    void (*on_tick)(process_t *p, long long wall, long long cpu); //p ran through its slice, optional
+    void (*on_block)(process_t *p, long long wall, long long cpu); //p spent most of its slice blocked, optional
+    void (*on_exit)(process_t *p); //p finished, optional
+    long long (*slice)(slot_t *sl, process_t *p); //length of p's next slice, optional (default quantum)
+} policy_t;
 
-    for (int i = 0; i < proc_count; i++) {
-        kill(processes[i].pid, SIGUSR1);
-    }
+typedef struct {
+    char name[64]; //argv[0] of the command
+    long long total_ns; //cpu time of every finished run
+    int runs;
+} history_t;
 
-    sleep(1);
-    for (int i = 0; i < proc_count; i++) {
-        kill(processes[i].pid, SIGSTOP);
-    }
+//structured log, written by the scheduler and formatted by a drain thread
+enum { LOG_SPAWN, LOG_RUN, LOG_STOP, LOG_EXIT, LOG_DEMOTE, LOG_BOOST, LOG_SAMPLE, LOG_DROP }; //log_event_t.type, also in mcp-analyze.c
+enum { LOG_TEXT, LOG_JSON, LOG_OFF }; //--log
+typedef struct {
+    long long time; //now_ns() when it happened
+    int type;
+    pid_t pid; //0 for events that aren't about one job
+    int slot; //-1 if none
+    long long a, b; //counters, named per type in log_kinds
+    char name[20]; //command name, truncated
+} log_event_t;
 
-    sa.sa_handler = handle_alarm;
-    sigemptyset(&sa.sa_mask);
-    sa.sa_flags = 0;
-    sigaction(SIGALRM, &sa, NULL);
+typedef struct {
+    const char *name;
+    const char *a, *b; //labels of the counters, NULL if unused
+    int quiet; //only recorded in the --trace file, too frequent for the log
+} log_kind_t;
 
-    alarm(TIME_SLICE);
-    while (1) {
-        int status;
-        pid_t pid = waitpid(-1, &status, WNOHANG);
-        if (pid > 0) {
-            for (int i = 0; i < proc_count; i++) {
-                if (processes[i].pid == pid) {
-                    processes[i].finished = 1;
-                    printf("MCP: Process %d (%s) finished\n", pid, processes[i].cmd);
-                    break;
-                }
-            }
+typedef struct {
+    char magic[8]; //TRACE_MAGIC
+    int version;
+    int record_size; //sizeof(log_event_t), the records follow the header back to back
+    int slots;
+    int reserved;
+    long long start; //batch_start, every job's submission time
+    char policy[16];
+} trace_header_t;
 
-            int all_done = 1;
-            for (int i = 0; i < proc_count; i++) {
-                if (!processes[i].finished) {
-                    all_done = 0;
-                    break;
-                }
+void log_event(int type, process_t *p, int slot, long long a, long long b); //appends an event to the ring without locking or allocating
+void log_start(void); //starts the drain thread
+void log_finish(void); //drains what is left and stops the drain thread
+void *log_drain(void *arg); //drain thread: formats ring entries to stdout as they arrive
+void log_print(log_event_t *e, int format, char *line, size_t size); //formats one event as a text or json line
+void log_record(log_event_t *e); //hands one drained event to the log and the trace
+
+//created for part4 run queues
+process_t *read_job(FILE *file); //reads the next non-empty line of the job file into a new process_t, NULL at end of file
+process_t *make_job(char *line); //parses a job line into a new process_t, NULL if it has no command or job_error says why not
+void free_job(process_t *p); //unlinks a reaped job from the live list and releases it
+void track_rss(process_t *p, long rss_kb); //records a new rss sample for the memory budget
+int read_proc_stats(process_t *p, proc_stats_t *stats); //fills stats from p's /proc/[pid]/stat and statm, 0 on success
+void record_sample(process_t *p, proc_stats_t *stats); //folds a sample into p's cpu, rss and i/o totals
+void refresh_accounting(void); //samples every live job in one pass
+int taskstats_refresh(void); //bulk-samples every live job over netlink, -1 if the socket failed
+void taskstats_reply(struct nlmsghdr *h); //records the stats one taskstats reply carries
+pid_t spawn_child_process(process_t *p, int *output); //starts p's command behind its gate, -1 with errno set if it can't run
+char **gate_command(process_t *p, int gate, char **line); //argument vector of the launcher that runs p's command once the gate opens
+void exec_launcher(process_t *p, char **args, int gate, int *output, int report); //child side of a spawn: sets p's rlimits and execs the launcher; never returns
+void report_failure(int report, int resource); //child side: sends the step that failed and errno to the MCP
+int read_report(process_t *p, int report); //MCP side: prints the rlimits the child couldn't set, errno of a failed exec or 0
+void run_gate(int gate, char **args); //launcher: waits for the job's first slice, then execs its command; never returns
+pid_t spawn_into_cgroup(process_t *p, int *output); //starts p's command inside a cgroup of its own behind its gate, -1 with errno set if it can't run
+void open_output(process_t *p, int *output); //--output: the job's pipes and files, the write ends for the child in output
+void drain_output(process_t *p, int stream, int all); //splices what the job wrote to stream 0 (stdout) or 1 (stderr) into its file
+void print_tail(long serial, int client); //the end of a job's output files, from the page cache rather than a copy of its own
+void cgroup_release(process_t *p); //kills whatever the job left behind in its cgroup and removes it
+void finish_job(process_t *p); //logs a finished job, hands its slot to the next one and releases it
+void suspend_job(process_t *p); //stops p, with --cgroup by freezing its whole cgroup
+void resume_job(process_t *p); //continues p, with --cgroup by thawing its whole cgroup
+void set_running(int slot, process_t *p); //records what the slot runs, keeping idle_slots in step
+void pid_insert(process_t *p); //maps a child's pid to its job
+process_t *pid_lookup(pid_t pid); //job of the child with this pid, NULL if unknown
+void pid_remove(pid_t pid); //forgets a reaped child
+void rq_push(runqueue_t *rq, process_t *p); //appends p at the tail
+void rq_remove(runqueue_t *rq, process_t *p); //unlinks p from anywhere in the queue
+void rb_insert(rbtree_t *tree, process_t *p); //adds p in key order
+void rb_erase(rbtree_t *tree, process_t *p); //removes p, rebalancing the tree
+process_t *rb_first(rbtree_t *tree); //smallest key, NULL if empty
+process_t *rb_last(rbtree_t *tree); //largest key, NULL if empty
+void enqueue_process(int slot, process_t *p); //queues p on the slot through the policy
+void dequeue_process(process_t *p); //takes p off whichever slot queues it
+void account_slice(process_t *p); //charges the expired slice to p from /proc and tells the policy
+long long slice_length(int slot, process_t *p); //quantum for p's next slice on slot
+char *parse_job_options(char *line, process_t *p, char **name, char **after); //strips leading key=value job options, returns the command or NULL for an unknown one
+pid_t sim_spawn(process_t *p); //parses p's profile in place of starting it, -1 with errno set if it has none
+void sim_suspend(process_t *p); //p lost its slot: its cpu burst stops progressing
+void sim_resume(process_t *p); //p got a slot: its cpu burst progresses again, or its first burst starts
+void sim_run(process_t *p); //p holds a slot and isn't waiting: schedules the end of its cpu burst or its exit
+void sim_next_burst(process_t *p); //p's burst ended, starts the next one
+void sim_burst_event(process_t *p); //p's cpu burst ran out, or it has no burst left and exits
+long long seconds_hint(const char *cmd); //value of a "-seconds N" argument in ns, 0 if absent
+long long job_estimate(process_t *p); //expected run time, what the critical path is measured in
+
+//job dependencies, from the name= and after= job options
+typedef struct dag_node {
+    char *name; //malloc'd
+    process_t *job; //NULL once it has finished
+    int failed; //it finished and failed, so every job after it is skipped
+    long long path; //once finished: the longest chain of cpu time ending with it
+    process_t **waiters; //jobs held until it finishes, malloc'd
+    int waiter_count, waiter_capacity;
+    int refs; //unfinished jobs with it among their after=, each reads its path when it finishes
+    int listed; //still in dag_table; a finished name registered again leaves it
+    int retained; //in the daemon's ring of recently finished names
+} dag_node_t;
+
+void dag_link(process_t *p, char *name, char *after); //holds p on its unfinished after= jobs and registers its name
+dag_node_t *dag_lookup(const char *name); //job registered under name=, NULL if none
+void dag_insert(dag_node_t *node); //registers a named job
+void dag_remove(dag_node_t *node); //takes a node out of the name table
+void dag_retire(dag_node_t *node); //frees a node nothing will read again, a daemon keeps the recent ones named
+void dag_raise(process_t *p); //lengthens the critical path of every unfinished job p runs after
+void dag_release(process_t *p); //p finished: records its chain and readies the jobs it was the last to hold
+void ready_push(process_t *p); //queues a job whose after= jobs have all finished, highest rank first
+
+//adaptive quantum, selected with --adaptive: tuned from the measured switch cost and the waits between slices
+void record_switch(int slot, process_t *p); //measures the switch that just put p on the slot and the wait it had
+void adapt_quantum(void); //retunes the quantum towards the overhead and response targets
+
+//per-job limits, from the cpu=, rss=, wall=, nofile= and overrun= job options
+void apply_limits(process_t *p); //arms a freshly spawned job's wall= deadline
+void check_limits(process_t *p); //compares p's latest sample with its cpu= and rss=, two compares per sample
+void over_limit(process_t *p, const char *which); //kills p, or with overrun=demote moves it behind every other job
+void kill_job(process_t *p); //SIGKILL, to the whole cgroup with --cgroup
+void arm_limit(long long when); //wakes the loop at the earliest wall= deadline
+void handle_limit_event(void); //a wall= deadline passed: acts on every job past its own and re-arms for the next
+
+//scheduling policies, selected with --policy
+void list_enqueue(slot_t *sl, process_t *p);
+void list_dequeue(slot_t *sl, process_t *p);
+process_t *list_head(slot_t *sl);
+process_t *list_tail(slot_t *sl);
+process_t *mlfq_pick(slot_t *sl);
+process_t *mlfq_steal(slot_t *sl);
+void mlfq_tick(process_t *p, long long wall, long long cpu);
+long long mlfq_slice(slot_t *sl, process_t *p);
+process_t *lottery_pick(slot_t *sl);
+void tree_enqueue(slot_t *sl, process_t *p);
+void tree_dequeue(slot_t *sl, process_t *p);
+process_t *tree_pick(slot_t *sl);
+process_t *tree_steal(slot_t *sl);
+void srtf_enqueue(slot_t *sl, process_t *p);
+void srtf_exit(process_t *p);
+void stride_tick(process_t *p, long long wall, long long cpu);
+void cfs_tick(process_t *p, long long wall, long long cpu);
+long long cfs_slice(slot_t *sl, process_t *p);
+void critical_enqueue(slot_t *sl, process_t *p);
+
+policy_t policies[] = {
+    { .name = "fifo", .preemptive = 0, .enqueue = list_enqueue, .dequeue = list_dequeue,
+      .pick_next = list_head, .steal = list_head },
+    { .name = "rr", .preemptive = 1, .enqueue = list_enqueue, .dequeue = list_dequeue,
+      .pick_next = list_head, .steal = list_tail },
+    { .name = "mlfq", .preemptive = 1, .enqueue = list_enqueue, .dequeue = list_dequeue,
+      .pick_next = mlfq_pick, .steal = mlfq_steal, .on_tick = mlfq_tick, .slice = mlfq_slice },
+    { .name = "srtf", .preemptive = 1, .enqueue = srtf_enqueue, .dequeue = tree_dequeue,
+      .pick_next = tree_pick, .steal = tree_steal, .on_exit = srtf_exit },
+    { .name = "lottery", .preemptive = 1, .enqueue = list_enqueue, .dequeue = list_dequeue,
+      .pick_next = lottery_pick, .steal = list_tail },
+    { .name = "stride", .preemptive = 1, .enqueue = tree_enqueue, .dequeue = tree_dequeue,
+      .pick_next = tree_pick, .steal = tree_steal, .on_tick = stride_tick, .on_block = stride_tick },
+    { .name = "cfs", .preemptive = 1, .enqueue = tree_enqueue, .dequeue = tree_dequeue,
+      .pick_next = tree_pick, .steal = tree_steal, .on_tick = cfs_tick, .on_block = cfs_tick, .slice = cfs_slice },
+    { .name = "critical", .preemptive = 1, .enqueue = critical_enqueue, .dequeue = tree_dequeue,
+      .pick_next = tree_pick, .steal = tree_pick },
+};
+
+process_t *jobs = NULL; //every spawned job that hasn't been reaped yet
+process_t *arriving = NULL; //next job of the file, read but not submitted until its arrive= time
+process_t *ready = NULL; //held jobs whose after= jobs have all finished, highest rank first
+int held_count = 0; //jobs read but not yet spawned because of after=, ready ones included
+process_t *submitted = NULL, *submitted_tail = NULL; //daemon: submitted jobs admit_jobs hasn't taken yet, oldest first
+int live_count = 0;
+long job_count = 0; //jobs read or submitted so far, the last one's serial
+long long batch_start = 0, last_finish = 0, total_turnaround = 0; //for print_summary, kept as jobs are freed
+
+FILE *job_file = NULL; //rest of the input, NULL once every line has been admitted
+int admit_window = ADMIT_WINDOW;
+long long mem_budget = 0; //bytes of summed job rss above which no more jobs are admitted, 0 for none
+double cpu_budget = 0; //cpu pressure (psi "some avg10" percent) above which no more jobs are admitted, 0 for none
+long live_rss_kb = 0;
+long long default_quantum = TIME_SLICE * NSEC_PER_SEC;
+
+slot_t *slots = NULL;
+int slot_count = 0; //jobs that run at the same time, one per online CPU by default
+int pin_slots = 0;
+int idle_slots = 0; //slots with nothing running, so kick_idle_slots can skip the scan when there are none
+
+policy_t *policy = &policies[1]; //rr
+long long boost_interval = MLFQ_BOOST * NSEC_PER_SEC;
+int boost_fd = -1;
+long long tick_ns; //length of one /proc clock tick
+long page_kb; //statm counts pages
+long sample_count = 0; //read_proc_stats calls, with sample_ns their total cost for the status command
+long long sample_ns = 0;
+int use_taskstats = 0; //--accounting taskstats: bulk samples come from netlink instead of /proc
+int taskstats_fd = -1;
+int taskstats_family = 0; //generic netlink id of TASKSTATS
+long long last_refresh = 0; //now_ns() of the last refresh_accounting, the budget refreshes once per quantum
+long long refresh_cost = 0; //how long that refresh took, for the status command
+const char *cgroup_root = NULL; //--cgroup: delegated cgroup v2 directory the MCP creates its cgroups in
+int group_fd = -1; //the MCP's own cgroup under cgroup_root, parent of one cgroup per job
+const char *output_dir = NULL; //--output: jobs write to pipes spliced into files here instead of the MCP's stdout
+int output_dir_fd = -1;
+
+log_event_t log_ring[LOG_CAPACITY];
+atomic_ulong log_head = 0, log_tail = 0; //events logged and events drained, both only ever grow
+atomic_long log_dropped = 0; //events lost to a full ring since the drain last reported
+atomic_int log_stopping = 0;
+int log_format = LOG_TEXT;
+int log_active = 0; //something consumes events: the log, the trace or both
+FILE *trace_file = NULL; //--trace: binary copy of every event for mcp-analyze
+int log_block = 0; //--log-drop block: a full ring stalls the scheduler instead of dropping
+pthread_t log_thread;
+log_kind_t log_kinds[] = {
+    [LOG_SPAWN] = { "spawn", "live", "arrive_ms" },
+    [LOG_RUN] = { "run", "cpu_ms", "rss_kb" },
+    [LOG_STOP] = { "stop", "cpu_ms", "slice_us" },
+    [LOG_EXIT] = { "exit", "cpu_ms", "turnaround_ms" },
+    [LOG_DEMOTE] = { "demote", "cpu_us", "level" },
+    [LOG_BOOST] = { "boost", NULL, NULL },
+    [LOG_SAMPLE] = { "sample", "cpu_us", "wall_us", 1 },
+    [LOG_DROP] = { "dropped", "count", NULL },
+};
+
+dag_node_t **dag_table = NULL; //open-addressed name -> job, finished entries stay for the whole batch so later lines can name them
+size_t dag_capacity = 0; //power of two, kept at least twice the entries
+size_t dag_entries = 0;
+int dag_used = 0; //some line has after=
+dag_node_t *retained[DAG_RETAIN]; //daemon: finished names no job is after, oldest at retain_head, removed once the ring is full
+size_t retain_head = 0, retain_count = 0;
+int job_client = -1; //daemon client whose submission make_job is parsing, job line warnings go back to it
+char job_error[128]; //why make_job rejected the last line, empty when it just had no command
+long long longest_path = 0; //longest chain of cpu time through after= links, for print_summary
+
+history_t history[HISTORY_SIZE]; //srtf: cpu time of finished commands, by name
+int history_count = 0;
+
+process_t **pid_table = NULL; //open-addressed pid -> job, NULL marks an empty bucket
+size_t pid_capacity = 0; //power of two, kept at least twice the live entries
+size_t pid_entries = 0;
+
+sigset_t orig_mask; //signal mask to restore in children before exec
+sigset_t loop_mask; //signals delivered through signal_fd instead of handlers
+int epoll_fd = -1;
+int signal_fd = -1;
+int arrival_fd = -1;
+int limit_fd = -1; //timerfd for the earliest wall= deadline
+long long limit_deadline = 0; //what it is armed for, 0 when no job has wall=
+runqueue_t background = { NULL, NULL, 0 }; //stopped jobs demoted by overrun=demote, oldest first
+double adapt_overhead = 0; //--adaptive: target share of a slot lost to switching, in percent, 0 for a fixed quantum
+long long adapt_response = 0; //--adaptive: target p99 wait between slices in ns, 0 for none
+long long switch_cost = 0; //moving average of the time from a slice's deadline to the next job running
+long long adapt_floor = 0; //shortest quantum that meets the overhead target at that switch cost
+histogram_t wait_hist; //waits between slices in thousandths of the quantum, halved at each adjustment
+int adapt_samples = 0; //waits recorded since the last adjustment
+long adapt_count = 0; //adjustments so far
+int control_open = 0; //stdin is still registered for control commands
+const char *listen_path = NULL; //--listen: the daemon's socket, NULL when the MCP runs one file and exits
+int listen_fd = -1; //-1 once the daemon stops accepting, the loop then ends like a batch
+client_t clients[MAX_CLIENTS];
+pthread_mutex_t stream_lock = PTHREAD_MUTEX_INITIALIZER; //guards clients[].streaming and closing their fds against the drain
+atomic_int stream_count = 0; //streaming clients, so the drain skips the lock when there are none
+
+int simulate = 0; //--simulate: jobs are profiles run in virtual time, now_ns() is sim_now
+long long sim_now = 0;
+sim_event_t *sim_heap = NULL; //binary min-heap on time, then push order
+size_t sim_length = 0, sim_capacity = 0;
+long sim_order = 0;
+long sim_events = 0; //events handled, reported with the simulation's cost
+
+int main(int argc, char *argv[]) {
+
+    static struct option long_options[] = {
+        {"quantum", required_argument, NULL, 'q'},
+        {"slots", required_argument, NULL, 'j'},
+        {"pin", no_argument, NULL, 'p'},
+        {"policy", required_argument, NULL, 'P'},
+        {"boost", required_argument, NULL, 'b'},
+        {"window", required_argument, NULL, 'w'},
+        {"mem-budget", required_argument, NULL, 'M'},
+        {"cpu-budget", required_argument, NULL, 'C'},
+        {"accounting", required_argument, NULL, 'A'},
+        {"cgroup", required_argument, NULL, 'G'},
+        {"log", required_argument, NULL, 'L'},
+        {"log-drop", required_argument, NULL, 'D'},
+        {"trace", required_argument, NULL, 'T'},
+        {"simulate", no_argument, NULL, 'S'},
+        {"listen", required_argument, NULL, 'l'},
+        {"output", required_argument, NULL, 'O'},
+        {"adaptive", required_argument, NULL, 'a'},
+        {NULL, 0, NULL, 0}
+    };
+    int opt, usage = 0;
+
+    if (argc > 3 && strcmp(argv[1], GATE_ARG) == 0) run_gate(atoi(argv[2]), argv + 3); //a job's launcher, see spawn_child_process
+    sigprocmask(SIG_SETMASK, NULL, &orig_mask);
+    while (!usage && (opt = getopt_long(argc, argv, "q:j:pw:", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 'q':
+            default_quantum = parse_duration(optarg);
+            if (default_quantum <= 0) {
+                fprintf(stderr, "Invalid quantum '%s' (e.g. 1s, 10ms, 250us)\n", optarg);
+                exit(EXIT_FAILURE);
             }
-            if (all_done) break;
+            break;
+        case 'j':
+            slot_count = atoi(optarg);
+            if (slot_count <= 0) {
+                fprintf(stderr, "Invalid slot count '%s'\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'p':
+            pin_slots = 1;
+            break;
+        case 'P':
+            policy = NULL;
+            for (size_t i = 0; i < sizeof(policies) / sizeof(policies[0]); i++) {
+                if (strcmp(optarg, policies[i].name) == 0) policy = &policies[i];
+            }
+            if (!policy) {
+                fprintf(stderr, "Unknown policy '%s' (fifo, rr, mlfq, srtf, lottery, stride, cfs, critical)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'b':
+            boost_interval = parse_duration(optarg);
+            if (boost_interval <= 0) {
+                fprintf(stderr, "Invalid boost interval '%s'\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'w':
+            admit_window = atoi(optarg);
+            if (admit_window <= 0) {
+                fprintf(stderr, "Invalid window '%s'\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'M':
+            mem_budget = parse_size(optarg);
+            if (mem_budget <= 0) {
+                fprintf(stderr, "Invalid memory budget '%s' (e.g. 512M, 2G)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'C':
+            cpu_budget = atof(optarg);
+            if (cpu_budget <= 0 || cpu_budget > 100) {
+                fprintf(stderr, "Invalid cpu budget '%s' (pressure percent, 0-100)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'A':
+            if (strcmp(optarg, "proc") == 0) {
+                use_taskstats = 0;
+            } else if (strcmp(optarg, "taskstats") == 0) {
+                use_taskstats = 1;
+            } else {
+                fprintf(stderr, "Unknown accounting backend '%s' (proc, taskstats)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'G':
+            cgroup_root = optarg;
+            break;
+        case 'L':
+            if (strcmp(optarg, "text") == 0) log_format = LOG_TEXT;
+            else if (strcmp(optarg, "json") == 0) log_format = LOG_JSON;
+            else if (strcmp(optarg, "off") == 0) log_format = LOG_OFF;
+            else {
+                fprintf(stderr, "Unknown log format '%s' (text, json, off)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'T':
+            trace_file = fopen(optarg, "wb");
+            if (!trace_file) {
+                perror("fopen trace");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'S':
+            simulate = 1;
+            break;
+        case 'l':
+            listen_path = optarg;
+            break;
+        case 'O':
+            output_dir = optarg;
+            output_dir_fd = open(optarg, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (output_dir_fd < 0) {
+                perror("open output directory");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'a': {
+            //overhead[,response], e.g. 1%,50ms: at most 1% of each slot lost to switching, p99 wait under 50 ms
+            char *response = strchr(optarg, ',');
+            adapt_overhead = atof(optarg);
+            if (response) adapt_response = parse_duration(response + 1);
+            if (adapt_overhead <= 0 || adapt_overhead >= 100 || (response && adapt_response <= 0)) {
+                fprintf(stderr, "Invalid adaptive target '%s' (overhead percent[,p99 wait], e.g. 1%%,50ms)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        }
+        case 'D':
+            if (strcmp(optarg, "drop") == 0) log_block = 0;
+            else if (strcmp(optarg, "block") == 0) log_block = 1;
+            else {
+                fprintf(stderr, "Unknown log drop policy '%s' (drop, block)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        default:
+            usage = 1; //unknown option or missing argument, stop parsing and print the usage message
+        }
+    }
+#ifdef MCPD
+    if (!listen_path) listen_path = default_socket(); //mcpd is the MCP built to listen unless told where
+#endif
+    //a daemon can start without a file, it runs one first if given
+    if (usage || (optind != argc - 1 && !(listen_path && optind == argc))) {
+        fprintf(stderr, "Usage: %s [-q quantum] [-j slots] [--pin] [--policy name] [--boost interval]\n"
+                        "       [-w window] [--mem-budget size] [--cpu-budget pressure] [--accounting proc|taskstats]\n"
+                        "       [--cgroup dir] [--log text|json|off] [--log-drop drop|block]\n"
+                        "       [--trace file] [--simulate] [--listen socket] [--output dir]\n"
+                        "       [--adaptive overhead%%[,p99 wait]] <input_file>\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (simulate && (cgroup_root || pin_slots || use_taskstats || cpu_budget > 0 || listen_path || output_dir)) {
+        fprintf(stderr, "--simulate runs no processes, so --cgroup, --pin, --accounting taskstats, --cpu-budget, --listen and --output don't apply\n");
+        exit(EXIT_FAILURE);
+    }
+    if (use_taskstats && taskstats_open() < 0) {
+        printf("MCP: taskstats unavailable (%s), accounting from /proc\n", strerror(errno));
+        use_taskstats = 0;
+    }
+    if (cgroup_root) cgroup_setup();
+    if (optind < argc) {
+        job_file = fopen(argv[optind], "r");
+        if (!job_file) {
+            perror("fopen");
+            exit(EXIT_FAILURE);
         }
-        pause(); // wait for SIGALRM
     }
 
+    //SIGCHLD must be blocked before the first fork so no exit is missed before signal_fd exists
+    if (simulate) setup_simulation();
+    else setup_event_loop();
+    if (listen_path) setup_listener();
+
+    batch_start = now_ns();
+    log_start();
+    if (simulate) run_simulation();
+    else run_event_loop(); //admits the first window and starts the first slices right away
+    log_finish();
+
+    if (cgroup_root) cgroup_teardown();
     printf("MCP: All processes have completed.\n");
+    print_summary();
     return 0;
 }
 
@@ -103,124 +709,2848 @@ void trim_newline(char *str) {
     if (len > 0 && str[len - 1] == '\n') str[len - 1] = '\0';
 }
 
-int read_input_file(const char *filename, char lines[][MAX_LINE]) {
-    //reads input lines from the given file and stores them in the lines array
-    //returns the number of lines, array is passed via reference so not returned
-    FILE *file = fopen(filename, "r");
-    if (!file) {
-        perror("fopen");
+process_t *read_job(FILE *file) {
+    //reads the next non-empty line of the job file into a new process_t, NULL at end of file
+    //getline grows the buffer as needed, so only the job being read is held in memory
+    static char *line = NULL;
+    static size_t capacity = 0;
+
+    while (getline(&line, &capacity, file) != -1) {
+        trim_newline(line);
+        process_t *p = make_job(line);
+        if (p) return p;
+        if (job_error[0]) fprintf(stderr, "MCP: Skipping a job line, %s\n", job_error);
+    }
+    free(line);
+    line = NULL;
+    capacity = 0;
+    return NULL;
+}
+
+process_t *make_job(char *line) {
+    //parses a job line, options and all, into a new process_t, NULL if it has no command or an unknown
+    //option, which job_error then names
+    process_t *p = calloc(1, sizeof(process_t));
+    if (!p) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    char *name, *after;
+    char *cmd = parse_job_options(line, p, &name, &after);
+    if (!cmd || strlen(cmd) == 0) {
+        free(p);
+        return NULL;
+    }
+    p->cmd = strdup(cmd);
+    if (!p->cmd) {
+        perror("strdup");
         exit(EXIT_FAILURE);
     }
-    int count = 0;
-    while (fgets(lines[count], MAX_LINE, file) != NULL && count < MAX_CMDS) {
-        trim_newline(lines[count]);
-        count++;
+    p->slot = -1;
+    p->last_slot = -1;
+    p->queued_on = -1;
+    p->stat_fd = -1;
+    p->statm_fd = -1;
+    p->io_bytes = -1;
+    p->cgroup_fd = -1;
+    p->freeze_fd = -1;
+    p->gate_fd = -1;
+    p->burst = -1;
+    p->cpu_since = -1;
+    p->out_fd[0] = p->out_fd[1] = -1;
+    p->file_fd[0] = p->file_fd[1] = -1;
+    p->hint = seconds_hint(cmd);
+    p->rank = job_estimate(p);
+    p->serial = ++job_count;
+    dag_link(p, name, after);
+    return p;
+}
+
+void free_job(process_t *p) {
+    //unlinks a reaped job from the live list and releases it
+    //its turnaround is folded into the summary totals first
+    if (p->finished_at > last_finish) last_finish = p->finished_at;
+    dag_release(p);
+    live_rss_kb -= p->rss_kb;
+    total_turnaround += p->finished_at - p->submitted_at; //time waiting for admission counts too
+
+    if (p->job_prev) p->job_prev->job_next = p->job_next;
+    else jobs = p->job_next;
+    if (p->job_next) p->job_next->job_prev = p->job_prev;
+    live_count--;
+    cgroup_release(p);
+    if (p->stat_fd >= 0) close(p->stat_fd);
+    if (p->statm_fd >= 0) close(p->statm_fd);
+    if (p->gate_fd >= 0) close(p->gate_fd);
+    for (int i = 0; i < 2; i++) {
+        if (p->out_fd[i] >= 0) close(p->out_fd[i]); //a background child still writing gets SIGPIPE
+        if (p->file_fd[i] >= 0) close(p->file_fd[i]);
+    }
+    free(p->profile);
+    free(p->cmd);
+    free(p);
+}
+
+void track_rss(process_t *p, long rss_kb) {
+    //records a new rss sample for the memory budget
+    if (rss_kb < 0) return;
+    live_rss_kb += rss_kb - p->rss_kb;
+    p->rss_kb = rss_kb;
+}
+
+void admit_jobs(void) {
+    //spawns jobs from the job file while the window and budgets allow
+    //each job is stopped as soon as it is spawned and queued on the least loaded slot
+    //jobs whose after= jobs just finished go first, the most critical of them before the rest
+    process_t *p;
+    while (live_count < admit_window && (live_count == 0 || within_budget())) {
+        if (ready) {
+            p = ready;
+            ready = p->job_next;
+            held_count--;
+        } else {
+            //held jobs cost no process, but reading stops at a window of them too
+            if (held_count >= admit_window) break;
+            if (!arriving && job_file) {
+                if ((arriving = read_job(job_file)) == NULL) {
+                    fclose(job_file);
+                    job_file = NULL;
+                } else {
+                    //a line is submitted when the MCP starts unless arrive= delays it, so lines must arrive in order
+                    arriving->submitted_at = batch_start + arriving->arrive;
+                    if (arriving->submitted_at > now_ns()) arm_arrival(arriving->submitted_at);
+                }
+            }
+            if (!arriving && submitted) {
+                //daemon submissions follow the file, in the order they were made
+                arriving = submitted;
+                submitted = arriving->job_next;
+                arriving->job_next = NULL;
+                if (arriving->submitted_at > now_ns()) arm_arrival(arriving->submitted_at);
+            }
+            if (!arriving) break;
+            if (arriving->submitted_at > now_ns() && !arriving->cancelled) break; //a cancelled one needn't wait for its arrive=
+            p = arriving;
+            arriving = NULL;
+            if (p->waiting > 0) {
+                held_count++; //dag_release readies it when the last of its after= jobs finishes
+                continue;
+            }
+        }
+        p->job_next = jobs;
+        if (jobs) jobs->job_prev = p;
+        jobs = p;
+        live_count++;
+
+        p->spawned_at = now_ns();
+        if (p->after_failed || p->cancelled) {
+            //cancelled, or its input was never made: the job finishes here and still counts in the summary
+            printf("MCP: Skipping '%s', %s\n", p->cmd, p->cancelled ? "it was cancelled" : "a job it runs after failed");
+            p->failed = 1;
+            p->finished_at = now_ns();
+            free_job(p);
+            continue;
+        }
+        if (!cgroup_root && (p->cpu_max > 0 || p->mem_max > 0)) {
+            printf("MCP: cpumax= and memmax= need --cgroup, ignored for '%s'\n", p->cmd);
+        }
+        if (simulate && (p->cpu_limit || p->rss_limit || p->wall_limit || p->nofile_limit)) {
+            //a simulated job has no process to signal or limit
+            printf("MCP: cpu=, rss=, wall= and nofile= aren't simulated, ignored for '%s'\n", p->cmd);
+            p->cpu_limit = p->rss_limit = p->wall_limit = 0;
+            p->nofile_limit = 0;
+        }
+        int output[2] = { -1, -1 };
+        if (output_dir) open_output(p, output);
+        if (simulate) p->pid = sim_spawn(p);
+        else p->pid = cgroup_root ? spawn_into_cgroup(p, output_dir ? output : NULL)
+                                  : spawn_child_process(p, output_dir ? output : NULL);
+        if (output_dir) {
+            //only the child keeps the write ends, so its exit is the pipes' end of file
+            close(output[0]);
+            close(output[1]);
+        }
+        if (p->pid < 0) {
+            //nothing to schedule, the job finishes here and still counts in the summary
+            printf("MCP: Could not run '%s': %s\n", p->cmd,
+                   simulate && errno == EINVAL ? "no cpu:/io: profile or -seconds hint to simulate" : strerror(errno));
+            p->failed = 1;
+            p->finished_at = now_ns();
+            free_job(p);
+            continue;
+        }
+        pid_insert(p);
+        apply_limits(p);
+        for (int i = 0; output_dir && i < 2; i++) {
+            struct epoll_event ev = { .events = EPOLLIN, .data.u32 = EV_OUTPUT | (i ? EV_STDERR : 0) | p->pid };
+            epoll_ctl(epoll_fd, EPOLL_CTL_ADD, p->out_fd[i], &ev);
+        }
+        log_event(LOG_SPAWN, p, -1, live_count, p->arrive / 1000000);
+        p->stopped_at = now_ns();
+        p->stopped_quantum = default_quantum;
+
+        int slot = 0;
+        for (int i = 1; i < slot_count; i++) {
+            if (slots[i].queued < slots[slot].queued) slot = i;
+        }
+        enqueue_process(slot, p);
+    }
+    kick_idle_slots();
+}
+
+int within_budget(void) {
+    //whether the memory and cpu budgets leave room for another job
+    if (mem_budget > 0) {
+        //jobs that haven't been switched lately still grow, so every job is re-sampled once a quantum
+        if (now_ns() - last_refresh >= default_quantum) refresh_accounting();
+        if (live_rss_kb * 1024LL >= mem_budget) return 0;
+    }
+    if (cpu_budget > 0) {
+        //cpu pressure is the share of time runnable tasks waited for a cpu, so it rises only when
+        //the host is oversubscribed, not merely busy; without psi the budget is ignored
+        char buffer[128];
+        double some;
+        int fd = open("/proc/pressure/cpu", O_RDONLY | O_CLOEXEC);
+        if (fd >= 0) {
+            ssize_t n = read(fd, buffer, sizeof(buffer) - 1);
+            close(fd);
+            buffer[n > 0 ? n : 0] = '\0';
+            if (sscanf(buffer, "some avg10=%lf", &some) == 1 && some >= cpu_budget) return 0;
+        }
     }
-    fclose(file);
-    return count;
+    return 1;
 }
 
-void parse_command(char *line, char **args) {
-    //parses a single line into arguments suitable for execvp
+char **parse_command(char *line) {
+    //splits a line into a malloc'd, NULL-terminated argument vector suitable for execvp
+    size_t count = 0, capacity = 8;
+    char **args = malloc(capacity * sizeof(char *));
     char *token = strtok(line, " ");
-    int i = 0;
-    while (token != NULL && i < MAX_ARGS - 1) {
-        args[i++] = token;
+    while (args && token != NULL) {
+        if (count + 1 == capacity) {
+            capacity *= 2;
+            char **grown = realloc(args, capacity * sizeof(char *));
+            if (!grown) free(args);
+            args = grown;
+            if (!args) break;
+        }
+        args[count++] = token;
         token = strtok(NULL, " ");
     }
-    args[i] = NULL;
+    if (!args) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    args[count] = NULL;
+    return args;
 }
 
-void setup_sigusr1_blocking(sigset_t *sigset) {
-    //initialize signal set and add SIGUSR1
-    sigemptyset(sigset);
-    sigaddset(sigset, SIGUSR1);
+pid_t spawn_child_process(process_t *p, int *output) {
+    //starts p's command behind a gate, with its stdout and stderr on output[0] and output[1] unless output is NULL
+    //the child execs the MCP's own binary as a launcher that blocks reading the gate, and resume_job opens it on
+    //the job's first slice, so the command runs no instruction before the scheduler says so; the command is then
+    //exec'd like from a shell, so set-user-id and file capabilities apply as usual
+    //vfork shares the MCP's memory until the exec, so nothing is copied however large the MCP grows, and a
+    //launcher that can't be exec'd comes back through the report pipe as an error instead of a child that exits
+    //at once; by then the child has exec'd or exited, so reading the pipe to its end doesn't wait
+    int gate[2], report[2];
+    if (pipe2(gate, O_CLOEXEC) < 0 || pipe2(report, O_CLOEXEC) < 0) {
+        perror("spawn");
+        exit(EXIT_FAILURE);
+    }
+    char *line;
+    char **args = gate_command(p, gate[0], &line);
 
-    //block SIGUSR1 so it isn't handled immediately, allowing sigwait() to work
-    if (sigprocmask(SIG_BLOCK, sigset, NULL) < 0) {
-        perror("sigprocmask");
+    pid_t pid = vfork();
+    if (pid == 0) exec_launcher(p, args, gate[0], output, report[1]);
+    int err = pid < 0 ? errno : 0;
+    close(gate[0]);
+    close(report[1]);
+    if (pid > 0 && (err = read_report(p, report[0])) != 0) waitpid(pid, NULL, 0); //nothing to schedule
+    close(report[0]);
+    free(args);
+    free(line);
+    if (err != 0) {
+        close(gate[1]);
+        errno = err;
+        return -1;
+    }
+    p->gate_fd = gate[1];
+    return pid;
+}
+
+char **gate_command(process_t *p, int gate, char **line) {
+    //argument vector of the launcher: the MCP's binary with GATE_ARG, the gate's read end and then p's command
+    //*line is the malloc'd string the vector points into, freed with it
+    size_t size = strlen(SELF_EXE) + strlen(GATE_ARG) + strlen(p->cmd) + 16;
+    *line = malloc(size);
+    if (!*line) {
+        perror("malloc");
         exit(EXIT_FAILURE);
     }
+    snprintf(*line, size, "%s %s %d %s", SELF_EXE, GATE_ARG, gate, p->cmd);
+    return parse_command(*line);
+}
+
+void exec_launcher(process_t *p, char **args, int gate, int *output, int report) {
+    //child side of a spawn, between the clone and the exec: only syscalls, the MCP's memory is shared or a copy
+    //taken while other threads may hold locks; what fails goes to report, the child then exits
+    //rlimits carry over both execs, so the command starts with them and no prlimit from the MCP is needed
+    //cpu= is the MCP's to enforce; RLIMIT_CPU (SIGXCPU, SIGKILL a second later) only backs it up against a job
+    //that gets far past it between samples, and a job that may be demoted instead has none
+    struct rlimit limit;
+    sigprocmask(SIG_SETMASK, &orig_mask, NULL); //don't leak the MCP's blocked SIGCHLD into the command
+    if (p->nofile_limit > 0) {
+        limit.rlim_cur = limit.rlim_max = p->nofile_limit;
+        if (setrlimit(RLIMIT_NOFILE, &limit) < 0) report_failure(report, RLIMIT_NOFILE);
+    }
+    if (p->cpu_limit > 0 && !p->overrun_demote) {
+        limit.rlim_cur = (p->cpu_limit + NSEC_PER_SEC - 1) / NSEC_PER_SEC + 1; //whole seconds, past the MCP's own check
+        limit.rlim_max = limit.rlim_cur + 1;
+        if (setrlimit(RLIMIT_CPU, &limit) < 0) report_failure(report, RLIMIT_CPU);
+    }
+    //the launcher keeps the gate's read end across the exec
+    if ((!output || (dup2(output[0], STDOUT_FILENO) >= 0 && dup2(output[1], STDERR_FILENO) >= 0))
+        && fcntl(gate, F_SETFD, 0) == 0) {
+        execv(args[0], args);
+    }
+    report_failure(report, -1);
+    _exit(127);
 }
 
-pid_t fork_child_process(char *line, sigset_t *sigset) {
-    char *args[MAX_ARGS];
-    parse_command(line, args);
+void report_failure(int report, int resource) {
+    //child side: sends the rlimit that couldn't be set, or -1 for the dup2 or exec that ends the child, with errno
+    int record[2] = { resource, errno };
+    if (write(report, record, sizeof(record)) < 0) _exit(127);
+}
+
+int read_report(process_t *p, int report) {
+    //MCP side, once the child has exec'd or exited: prints the rlimits it couldn't set, which leave the job
+    //running without them, and returns the errno of a failed dup2 or exec, 0 if the launcher runs
+    int record[2], err = 0;
+    while (read(report, record, sizeof(record)) == sizeof(record)) {
+        if (record[0] < 0) err = record[1];
+        else printf("MCP: Could not set %s= of '%s': %s\n", record[0] == RLIMIT_NOFILE ? "nofile" : "cpu", p->cmd, strerror(record[1]));
+    }
+    return err;
+}
 
-    pid_t pid = fork();
-    if (pid < 0) {
-        //fork failed
-        perror("fork");
+void run_gate(int gate, char **args) {
+    //launcher: blocks until resume_job opens the gate on the job's first slice, then becomes the command
+    //a gate closed without opening, because the MCP exited, means the job never got a slice and doesn't run
+    char go;
+    ssize_t n;
+    while ((n = read(gate, &go, 1)) < 0 && errno == EINTR);
+    if (n != 1) exit(127);
+    close(gate);
+    execvp(args[0], args);
+    fprintf(stderr, "MCP: Could not run '%s': %s\n", args[0], strerror(errno));
+    exit(127);
+}
+
+void cgroup_setup(void) {
+    //creates the MCP's cgroup under the delegated --cgroup directory and enables what controllers it can
+    //the MCP itself stays where it is, so the new group holds only job cgroups and may delegate further
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/mcp-%d", cgroup_root, getpid());
+    if (mkdir(path, 0755) < 0) {
+        perror("mkdir cgroup");
+        exit(EXIT_FAILURE);
+    }
+    group_fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (group_fd < 0) {
+        perror("open cgroup");
         exit(EXIT_FAILURE);
-    } else if (pid == 0) {
-        //child process waits for SIGUSR1 before executing the command
-        printf("Child %d waiting for SIGUSR1...\n", getpid());
-        int sig;
-        sigwait(sigset, &sig); //wait until SIGUSR1 is received
+    }
+    int root_fd = open(cgroup_root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    const char *controllers[] = { "+cpu", "+memory" };
+    for (int i = 0; i < 2; i++) {
+        //each one separately, a subtree without memory delegated can still weight cpu
+        if (root_fd >= 0) cgroup_write(root_fd, "cgroup.subtree_control", controllers[i]);
+        cgroup_write(group_fd, "cgroup.subtree_control", controllers[i]);
+    }
+    if (root_fd >= 0) close(root_fd);
+}
+
+void cgroup_teardown(void) {
+    //removes the job cgroups that were still busy when their job was freed, then the MCP's own
+    char path[PATH_MAX];
+    for (int tries = 0; tries < 100; tries++) {
+        int busy = 0;
+        DIR *dir = fdopendir(dup(group_fd));
+        struct dirent *entry;
+        while (dir && (entry = readdir(dir)) != NULL) {
+            if (strncmp(entry->d_name, "job-", 4) != 0) continue;
+            cgroup_write(group_fd, "cgroup.kill", "1");
+            if (unlinkat(group_fd, entry->d_name, AT_REMOVEDIR) < 0) busy = 1;
+        }
+        if (dir) closedir(dir);
+        if (!busy) break;
+        usleep(10000); //killed stragglers leave their cgroup once the kernel has torn them down
+    }
+    close(group_fd);
+    snprintf(path, sizeof(path), "%s/mcp-%d", cgroup_root, getpid());
+    if (rmdir(path) < 0) fprintf(stderr, "MCP: Could not remove cgroup %s: %s\n", path, strerror(errno));
+}
+
+int cgroup_write(int dir_fd, const char *file, const char *value) {
+    //writes value to a control file of the cgroup open as dir_fd, 0 on success
+    int fd = openat(dir_fd, file, O_WRONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    ssize_t n = write(fd, value, strlen(value));
+    int saved = errno;
+    close(fd);
+    errno = saved;
+    return n < 0 ? -1 : 0;
+}
+
+pid_t spawn_into_cgroup(process_t *p, int *output) {
+    //starts p's command inside a cgroup of its own, behind a gate like spawn_child_process
+    //clone3 places the child in the cgroup before it runs a single instruction, so nothing it forks can
+    //escape, and the launcher it execs holds the command until its first slice; the cgroup can't be frozen
+    //first instead, a frozen child never reaches the exec CLONE_VFORK holds the MCP for
+    //the errno of a failed dup2 or exec comes back through the report pipe, as from spawn_child_process
+    char name[32], value[64];
+    snprintf(name, sizeof(name), "job-%ld", p->serial);
+    if (mkdirat(group_fd, name, 0755) < 0) return -1;
+    p->cgroup_fd = openat(group_fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (p->cgroup_fd < 0) return -1;
+    p->freeze_fd = openat(p->cgroup_fd, "cgroup.freeze", O_WRONLY | O_CLOEXEC);
 
-        printf("Child %d received SIGUSR1, executing: %s\n", getpid(), args[0]);
-        execvp(args[0], args);
+    if (p->weight != DEFAULT_WEIGHT) {
+        //both default to 100, so weight= carries over unchanged
+        snprintf(value, sizeof(value), "%d", p->weight > 10000 ? 10000 : p->weight);
+        if (cgroup_write(p->cgroup_fd, "cpu.weight", value) < 0) {
+            printf("MCP: Could not set cpu.weight of '%s': %s\n", p->cmd, strerror(errno));
+        }
+    }
+    if (p->cpu_max > 0) {
+        snprintf(value, sizeof(value), "%ld 100000", (long)(p->cpu_max * 100000));
+        if (cgroup_write(p->cgroup_fd, "cpu.max", value) < 0) {
+            printf("MCP: Could not set cpu.max of '%s': %s\n", p->cmd, strerror(errno));
+        }
+    }
+    if (p->mem_max > 0) {
+        snprintf(value, sizeof(value), "%lld", p->mem_max);
+        if (cgroup_write(p->cgroup_fd, "memory.max", value) < 0) {
+            printf("MCP: Could not set memory.max of '%s': %s\n", p->cmd, strerror(errno));
+        }
+    }
 
-        perror("execvp"); //if execvp fails (if it returns)
-        fprintf(stderr, "Child %d failed to exec command: %s\n", getpid(), args[0]);
+    int gate[2], report[2];
+    if (pipe2(gate, O_CLOEXEC) < 0 || pipe2(report, O_CLOEXEC) < 0) {
+        perror("spawn");
         exit(EXIT_FAILURE);
     }
+    char *line;
+    char **args = gate_command(p, gate[0], &line);
 
-    //parent returns child's PID
-    return pid;
+    struct clone_args clone = { 0 };
+    clone.flags = CLONE_INTO_CGROUP | CLONE_VFORK;
+    clone.exit_signal = SIGCHLD;
+    clone.cgroup = p->cgroup_fd;
+    pid_t pid = syscall(SYS_clone3, &clone, sizeof(clone));
+    if (pid == 0) exec_launcher(p, args, gate[0], output, report[1]);
+    int err = pid < 0 ? errno : 0;
+    close(gate[0]);
+    close(report[1]);
+    if (pid > 0 && (err = read_report(p, report[0])) != 0) {
+        waitpid(pid, NULL, 0); //the launcher couldn't be exec'd, nothing to schedule
+        pid = -1;
+    }
+    close(report[0]);
+    free(args);
+    free(line);
+    if (pid > 0) {
+        p->gate_fd = gate[1];
+        return pid;
+    }
+    close(gate[1]);
+    if (err == ENOSYS) {
+        //no clone3 (old kernel, or filtered): spawn behind the gate, then move the launcher in before it opens
+        pid = spawn_child_process(p, output);
+        if (pid >= 0) {
+            snprintf(value, sizeof(value), "%d", pid);
+            cgroup_write(p->cgroup_fd, "cgroup.procs", value);
+            return pid;
+        }
+        err = errno;
+    }
+    cgroup_release(p);
+    errno = err;
+    return -1;
 }
 
-void print_proc_stats(pid_t pid) {
-    //prints basic stats from /proc/[pid]/stat and /status
-    char path[64], buffer[1024];
-    FILE *fp;
-
-    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
-    fp = fopen(path, "r");
-    if (fp) {
-        unsigned long utime, stime, rss;
-        int ignore;
-        char comm[256];
-        fscanf(fp, "%d %s", &ignore, comm);
-        for (int i = 0; i < 11; ++i) fscanf(fp, "%*s");
-        fscanf(fp, "%lu %lu", &utime, &stime);
-        fclose(fp);
-        printf("PID %d (%s): utime=%lu, stime=%lu ", pid, comm, utime, stime);
-    }
-
-    snprintf(path, sizeof(path), "/proc/%d/status", pid);
-    fp = fopen(path, "r");
-    if (fp) {
-        while (fgets(buffer, sizeof(buffer), fp)) {
-            if (strncmp(buffer, "VmRSS:", 6) == 0) {
-                printf("%s", buffer);
-                break;
+void cgroup_release(process_t *p) {
+    //kills whatever the job left behind in its cgroup and removes it
+    //a job ends with its leader, so background children it forked don't outlive it unnoticed
+    char name[32];
+    if (p->cgroup_fd < 0) return;
+    cgroup_write(p->cgroup_fd, "cgroup.kill", "1");
+    if (p->freeze_fd >= 0) close(p->freeze_fd);
+    close(p->cgroup_fd);
+    p->cgroup_fd = -1;
+    p->freeze_fd = -1;
+    snprintf(name, sizeof(name), "job-%ld", p->serial);
+    unlinkat(group_fd, name, AT_REMOVEDIR); //still busy if stragglers are dying, cgroup_teardown retries
+}
+
+void open_output(process_t *p, int *output) {
+    //--output: a pipe for each of the job's stdout and stderr, and the job-N.out and job-N.err files they
+    //are spliced into; the write ends go to the child in output, the MCP reads without blocking
+    //the files are named by serial, so they can be found after the job is gone
+    for (int i = 0; i < 2; i++) {
+        char name[32];
+        int fds[2];
+        snprintf(name, sizeof(name), "job-%ld.%s", p->serial, i ? "err" : "out");
+        p->file_fd[i] = openat(output_dir_fd, name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (p->file_fd[i] < 0 || pipe2(fds, O_CLOEXEC) < 0) {
+            perror("output");
+            exit(EXIT_FAILURE);
+        }
+        fcntl(fds[0], F_SETFL, O_NONBLOCK); //the write end stays blocking, the job waits on a full pipe
+        p->out_fd[i] = fds[0];
+        output[i] = fds[1];
+    }
+}
+
+void drain_output(process_t *p, int stream, int all) {
+    //splices what the job wrote to stream 0 (stdout) or 1 (stderr) into its file, one chunk per event
+    //unless all: the pipe's pages move to the file without being copied through the MCP, and a
+    //file system that can't take them gets read and write instead
+    while (p->out_fd[stream] >= 0) {
+        ssize_t n = splice(p->out_fd[stream], NULL, p->file_fd[stream], NULL, OUTPUT_CHUNK, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n < 0 && errno == EINVAL) {
+            char buffer[1 << 16];
+            n = read(p->out_fd[stream], buffer, sizeof(buffer));
+            if (n > 0 && write(p->file_fd[stream], buffer, n) != n) n = -1;
+        }
+        if (n > 0) {
+            p->out_bytes[stream] += n;
+            if (all) continue;
+            return;
+        }
+        if (n < 0 && errno == EAGAIN) return;
+        //end of file, every writer has exited, or the file can't take more: closing the pipe takes it
+        //out of the epoll set
+        close(p->out_fd[stream]);
+        close(p->file_fd[stream]);
+        p->out_fd[stream] = -1;
+        p->file_fd[stream] = -1;
+    }
+}
+
+void print_tail(long serial, int client) {
+    //the last TAIL_BYTES of a job's output files, running or finished, each line prefixed with the stream
+    //it came from; read back from the file, whose end the page cache holds, rather than from a copy
+    //the MCP keeps of everything every job writes
+    char buffer[TAIL_BYTES + 1];
+    for (int i = 0; i < 2; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "job-%ld.%s", serial, i ? "err" : "out");
+        int fd = openat(output_dir_fd, name, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            reply(client, client < 0 ? "MCP: No output for job %ld\n" : "error no output for job %ld\n", serial);
+            return;
+        }
+        off_t size = lseek(fd, 0, SEEK_END), from = size > TAIL_BYTES ? size - TAIL_BYTES : 0;
+        ssize_t n = pread(fd, buffer, size - from, from);
+        close(fd);
+        buffer[n > 0 ? n : 0] = '\0';
+        char *line = buffer;
+        if (from > 0 && (line = strchr(buffer, '\n')) != NULL) line++; //skip the partial first line
+        while (line && *line) {
+            char *end = strchr(line, '\n');
+            if (end) *end = '\0';
+            reply(client, "%s: %s\n", i ? "err" : "out", line);
+            line = end ? end + 1 : NULL;
+        }
+    }
+    if (client >= 0) reply(client, "ok\n");
+}
+
+void suspend_job(process_t *p) {
+    //stops p, with --cgroup by freezing its whole cgroup in one write
+    if (simulate) {
+        sim_suspend(p);
+        return;
+    }
+    if (p->freeze_fd >= 0 && write(p->freeze_fd, "1", 1) == 1) return;
+    kill(p->pid, SIGSTOP);
+}
+
+void resume_job(process_t *p) {
+    //continues p, with --cgroup by thawing its whole cgroup in one write
+    if (simulate) {
+        sim_resume(p);
+        return;
+    }
+    if (p->gate_fd >= 0) {
+        //its first slice: the launcher has been waiting on the gate, not stopped, and execs the command now
+        if (write(p->gate_fd, "", 1) < 0) kill(p->pid, SIGKILL); //can't be released, reaped as failed
+        close(p->gate_fd);
+        p->gate_fd = -1;
+        return;
+    }
+    if (p->freeze_fd >= 0 && write(p->freeze_fd, "0", 1) == 1) return;
+    kill(p->pid, SIGCONT);
+}
+
+int read_proc_stats(process_t *p, proc_stats_t *stats) {
+    //fills stats from p's /proc/[pid]/stat and statm, 0 on success
+    //both files stay open for the job's lifetime and are re-read with pread into a stack buffer,
+    //so a sample is two syscalls and no allocation instead of two fopens and a dozen fscanfs
+    if (simulate) {
+        //setup_simulation makes a tick one ns, so the simulated cpu time goes through unrounded
+        stats->comm[0] = '\0';
+        stats->utime = p->sim_cpu + (p->cpu_since >= 0 ? sim_now - p->cpu_since : 0);
+        stats->stime = 0;
+        stats->rss_kb = -1;
+        stats->read_bytes = -1;
+        stats->write_bytes = -1;
+        return 0;
+    }
+    long long start = now_ns();
+    char buffer[1024]; //a stat line is 52 numbers and a 16 byte comm
+    if (p->stat_fd < 0) p->stat_fd = open_proc_file(p->pid, "stat");
+    if (p->statm_fd < 0) p->statm_fd = open_proc_file(p->pid, "statm");
+    if (p->stat_fd < 0) return -1;
+
+    ssize_t n = pread(p->stat_fd, buffer, sizeof(buffer) - 1, 0);
+    if (n <= 0) return -1; //reaped, the open file now fails with ESRCH instead of finding a reused pid
+    buffer[n] = '\0';
+
+    //comm may hold spaces and parentheses itself, so the numeric fields are counted from the last ')'
+    char *open = strchr(buffer, '(');
+    char *close = strrchr(buffer, ')');
+    if (!open || !close || close < open) return -1;
+    size_t len = close - open - 1;
+    if (len >= sizeof(stats->comm)) len = sizeof(stats->comm) - 1;
+    memcpy(stats->comm, open + 1, len);
+    stats->comm[len] = '\0';
+    const char *field = skip_fields(close + 1, 11); //state through cmajflt
+    stats->utime = parse_ulong(&field);
+    stats->stime = parse_ulong(&field);
+
+    stats->rss_kb = -1;
+    stats->read_bytes = -1;
+    stats->write_bytes = -1;
+    if (p->statm_fd >= 0 && (n = pread(p->statm_fd, buffer, sizeof(buffer) - 1, 0)) > 0) {
+        buffer[n] = '\0';
+        field = skip_fields(buffer, 1); //size, then resident
+        stats->rss_kb = parse_ulong(&field) * page_kb;
+    }
+
+    sample_count++;
+    sample_ns += now_ns() - start;
+    return 0;
+}
+
+void record_sample(process_t *p, proc_stats_t *stats) {
+    //folds a sample into p's cpu, rss and i/o totals
+    p->cpu_ns = (long long)(stats->utime + stats->stime) * tick_ns;
+    track_rss(p, stats->rss_kb);
+    if (stats->read_bytes >= 0) p->io_bytes = stats->read_bytes + stats->write_bytes;
+    check_limits(p);
+}
+
+void refresh_accounting(void) {
+    //samples every live job in one pass
+    //from /proc that is two preads per job; taskstats answers a batch of jobs per sendmsg and recvmmsg
+    //and needs no open files, which is what lets the budget follow thousands of jobs every quantum
+    last_refresh = now_ns();
+    if (!use_taskstats || taskstats_refresh() < 0) {
+        proc_stats_t stats;
+        for (process_t *p = jobs; p; p = p->job_next) {
+            if (read_proc_stats(p, &stats) == 0) record_sample(p, &stats);
+        }
+    }
+    refresh_cost = now_ns() - last_refresh;
+}
+
+int taskstats_open(void) {
+    //opens the taskstats netlink socket and looks up its family, -1 if the kernel has none
+    struct {
+        struct nlmsghdr n;
+        struct genlmsghdr g;
+        char attrs[64];
+    } msg;
+    char reply[1024];
+    struct sockaddr_nl kernel = { .nl_family = AF_NETLINK };
+    struct timeval timeout = { .tv_sec = 0, .tv_usec = 100000 }; //a lost reply can't stall the loop for longer
+
+    taskstats_fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_GENERIC);
+    if (taskstats_fd < 0) return -1;
+    setsockopt(taskstats_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    memset(&msg, 0, sizeof(msg));
+    msg.n.nlmsg_type = GENL_ID_CTRL;
+    msg.n.nlmsg_flags = NLM_F_REQUEST;
+    msg.g.cmd = CTRL_CMD_GETFAMILY;
+    msg.g.version = 1;
+    struct nlattr *attr = (struct nlattr *)msg.attrs;
+    attr->nla_type = CTRL_ATTR_FAMILY_NAME;
+    attr->nla_len = NLA_HDRLEN + sizeof(TASKSTATS_GENL_NAME);
+    memcpy((char *)attr + NLA_HDRLEN, TASKSTATS_GENL_NAME, sizeof(TASKSTATS_GENL_NAME));
+    msg.n.nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN) + NLA_ALIGN(attr->nla_len);
+
+    ssize_t n = -1;
+    if (sendto(taskstats_fd, &msg, msg.n.nlmsg_len, 0, (struct sockaddr *)&kernel, sizeof(kernel)) >= 0) {
+        n = recv(taskstats_fd, reply, sizeof(reply), 0);
+    }
+    struct nlmsghdr *h = (struct nlmsghdr *)reply;
+    if (n > 0 && NLMSG_OK(h, n) && h->nlmsg_type == NLMSG_ERROR) {
+        errno = -((struct nlmsgerr *)NLMSG_DATA(h))->error;
+    } else if (n > 0 && NLMSG_OK(h, n)) {
+        int left = h->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN);
+        attr = (struct nlattr *)((char *)NLMSG_DATA(h) + GENL_HDRLEN);
+        while (left >= NLA_HDRLEN && attr->nla_len >= NLA_HDRLEN && attr->nla_len <= left) {
+            if (attr->nla_type == CTRL_ATTR_FAMILY_ID) {
+                memcpy(&taskstats_family, (char *)attr + NLA_HDRLEN, sizeof(unsigned short));
             }
+            left -= NLA_ALIGN(attr->nla_len);
+            attr = (struct nlattr *)((char *)attr + NLA_ALIGN(attr->nla_len));
         }
-        fclose(fp);
     }
+    if (taskstats_family == 0) {
+        if (errno == 0) errno = ENOENT;
+        close(taskstats_fd);
+        taskstats_fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+int taskstats_refresh(void) {
+    //bulk-samples every live job over netlink, -1 if the socket failed
+    //the kernel handles every request packed into one sendmsg in turn, and recvmmsg takes the
+    //replies a batch at a time; a job that exited answers with an error and is left alone
+    struct request {
+        struct nlmsghdr n;
+        struct genlmsghdr g;
+        struct nlattr attr;
+        unsigned int pid;
+    };
+    static struct request requests[TASKSTATS_BATCH];
+    static char replies[TASKSTATS_BATCH][1024]; //a reply is about 600 bytes, newer kernels add fields
+    struct mmsghdr messages[TASKSTATS_BATCH];
+    struct iovec iovecs[TASKSTATS_BATCH];
+    struct sockaddr_nl kernel = { .nl_family = AF_NETLINK };
+
+    process_t *p = jobs;
+    while (p) {
+        int count = 0;
+        for (; p && count < TASKSTATS_BATCH; p = p->job_next, count++) {
+            struct request *r = &requests[count];
+            memset(r, 0, sizeof(*r));
+            r->n.nlmsg_len = sizeof(*r);
+            r->n.nlmsg_type = taskstats_family;
+            r->n.nlmsg_flags = NLM_F_REQUEST;
+            r->n.nlmsg_seq = count;
+            r->g.cmd = TASKSTATS_CMD_GET;
+            r->g.version = TASKSTATS_GENL_VERSION;
+            r->attr.nla_type = TASKSTATS_CMD_ATTR_PID;
+            r->attr.nla_len = NLA_HDRLEN + sizeof(r->pid);
+            r->pid = p->pid;
+        }
+        if (sendto(taskstats_fd, requests, count * sizeof(struct request), 0,
+                   (struct sockaddr *)&kernel, sizeof(kernel)) < 0) {
+            return -1;
+        }
+
+        //every request gets exactly one reply, stats or an error
+        int received = 0;
+        while (received < count) {
+            for (int i = 0; i < count - received; i++) {
+                iovecs[i].iov_base = replies[i];
+                iovecs[i].iov_len = sizeof(replies[i]);
+                memset(&messages[i], 0, sizeof(messages[i]));
+                messages[i].msg_hdr.msg_iov = &iovecs[i];
+                messages[i].msg_hdr.msg_iovlen = 1;
+            }
+            int n = recvmmsg(taskstats_fd, messages, count - received, MSG_WAITFORONE, NULL);
+            if (n <= 0) return -1; //timed out, refresh_accounting redoes the pass from /proc
+            for (int i = 0; i < n; i++) {
+                struct nlmsghdr *h = (struct nlmsghdr *)replies[i];
+                if (NLMSG_OK(h, messages[i].msg_len)) taskstats_reply(h);
+            }
+            received += n;
+        }
+    }
+    return 0;
+}
+
+void taskstats_reply(struct nlmsghdr *h) {
+    //records the stats one taskstats reply carries
+    //the reply nests the pid and a struct taskstats inside TASKSTATS_TYPE_AGGR_PID
+    if (h->nlmsg_type == NLMSG_ERROR) return;
+    int left = h->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN);
+    struct nlattr *attr = (struct nlattr *)((char *)NLMSG_DATA(h) + GENL_HDRLEN);
+    if (left < NLA_HDRLEN || attr->nla_type != TASKSTATS_TYPE_AGGR_PID) return;
+
+    unsigned int pid = 0;
+    struct taskstats ts;
+    int have_stats = 0;
+    left = attr->nla_len - NLA_HDRLEN;
+    attr = (struct nlattr *)((char *)attr + NLA_HDRLEN);
+    while (left >= NLA_HDRLEN && attr->nla_len >= NLA_HDRLEN && attr->nla_len <= left) {
+        int len = attr->nla_len - NLA_HDRLEN;
+        if (attr->nla_type == TASKSTATS_TYPE_PID && len >= (int)sizeof(pid)) {
+            memcpy(&pid, (char *)attr + NLA_HDRLEN, sizeof(pid));
+        } else if (attr->nla_type == TASKSTATS_TYPE_STATS) {
+            //older kernels send a shorter struct, newer ones a longer one
+            memset(&ts, 0, sizeof(ts));
+            memcpy(&ts, (char *)attr + NLA_HDRLEN, len < (int)sizeof(ts) ? len : (int)sizeof(ts));
+            have_stats = 1;
+        }
+        left -= NLA_ALIGN(attr->nla_len);
+        attr = (struct nlattr *)((char *)attr + NLA_ALIGN(attr->nla_len));
+    }
+
+    process_t *p = pid_lookup(pid);
+    if (!p || !have_stats) return;
+    proc_stats_t stats;
+    snprintf(stats.comm, sizeof(stats.comm), "%.*s", TS_COMM_LEN, ts.ac_comm);
+    stats.utime = ts.ac_utime * 1000 / tick_ns; //microseconds, kept in clock ticks like /proc
+    stats.stime = ts.ac_stime * 1000 / tick_ns;
+    stats.rss_kb = ts.hiwater_rss; //taskstats has only the peak, which errs on the safe side for the budget
+    stats.read_bytes = ts.read_bytes;
+    stats.write_bytes = ts.write_bytes;
+    record_sample(p, &stats);
+}
+
+void log_event(int type, process_t *p, int slot, long long a, long long b) {
+    //appends an event to the ring without locking or allocating
+    //single producer, single consumer: only the scheduler moves log_head and only the drain moves log_tail
+    //a simulation has no drain thread, nothing real waits on it, so its events are recorded in place
+    if (!log_active) return;
+    log_event_t event, *e = &event;
+    unsigned long head = atomic_load_explicit(&log_head, memory_order_relaxed);
+    while (!simulate && head - atomic_load_explicit(&log_tail, memory_order_acquire) >= LOG_CAPACITY) {
+        if (!log_block) {
+            atomic_fetch_add_explicit(&log_dropped, 1, memory_order_relaxed);
+            return;
+        }
+        sched_yield(); //--log-drop block: wait for the drain rather than lose the event
+    }
+
+    if (!simulate) e = &log_ring[head & (LOG_CAPACITY - 1)];
+    e->time = now_ns();
+    e->type = type;
+    e->pid = p ? p->pid : 0;
+    e->slot = slot;
+    e->a = a;
+    e->b = b;
+    //basename of argv[0], the job's cmd is freed long before the drain might get to it
+    size_t len = 0;
+    const char *c = p ? p->cmd : "";
+    for (; *c && *c != ' '; c++) {
+        if (*c == '/') len = 0;
+        else if (len < sizeof(e->name) - 1) e->name[len++] = *c;
+    }
+    e->name[len] = '\0';
+    if (simulate) log_record(e);
+    else atomic_store_explicit(&log_head, head + 1, memory_order_release);
+}
+
+void log_start(void) {
+    //starts the drain thread
+    //it inherits the blocked SIGCHLD, so the signalfd stays the only place exits are seen
+    log_active = log_format != LOG_OFF || trace_file || listen_path; //a daemon may get streaming clients any time
+    if (!log_active) return;
+    if (trace_file) {
+        trace_header_t header = { .magic = TRACE_MAGIC, .version = TRACE_VERSION,
+                                  .record_size = sizeof(log_event_t), .slots = slot_count, .start = batch_start };
+        snprintf(header.policy, sizeof(header.policy), "%s", policy->name);
+        setvbuf(trace_file, NULL, _IOFBF, 1 << 16);
+        fwrite(&header, sizeof(header), 1, trace_file);
+    }
+    if (simulate) return;
+    int err = pthread_create(&log_thread, NULL, log_drain, NULL);
+    if (err != 0) {
+        fprintf(stderr, "pthread_create: %s\n", strerror(err));
+        exit(EXIT_FAILURE);
+    }
+}
+
+void log_finish(void) {
+    //drains what is left and stops the drain thread
+    if (!log_active) return;
+    if (!simulate) {
+        atomic_store(&log_stopping, 1);
+        pthread_join(log_thread, NULL);
+    }
+    if (trace_file && fclose(trace_file) != 0) perror("trace");
 }
 
-void handle_alarm(int sig) {
-    //signal handler for SIGALRM to simulate time-slice switching
-    if (current >= 0 && !processes[current].finished) {
-        kill(processes[current].pid, SIGSTOP);
+void *log_drain(void *arg) {
+    //drain thread: formats ring entries to stdout as they arrive
+    //it polls rather than being woken, so logging an event never costs the scheduler a syscall
+    (void)arg;
+    struct timespec nap = { 0, 2000000 };
+    while (1) {
+        int stopping = atomic_load(&log_stopping); //read first, so everything logged before the stop is seen below
+        unsigned long tail = atomic_load_explicit(&log_tail, memory_order_relaxed);
+        unsigned long head = atomic_load_explicit(&log_head, memory_order_acquire);
+        for (; tail != head; tail++) {
+            log_record(&log_ring[tail & (LOG_CAPACITY - 1)]);
+            atomic_store_explicit(&log_tail, tail + 1, memory_order_release);
+        }
+        long dropped = atomic_exchange_explicit(&log_dropped, 0, memory_order_relaxed);
+        if (dropped > 0) {
+            //recorded in the trace too, so an analysis knows its timeline has holes
+            log_event_t lost = { .time = now_ns(), .type = LOG_DROP, .slot = -1, .a = dropped };
+            log_record(&lost);
+        }
+        fflush(stdout);
+        if (stopping) break;
+        nanosleep(&nap, NULL);
     }
+    return NULL;
+}
+
+void log_record(log_event_t *e) {
+    //hands one drained event to the log, the trace and any streaming daemon clients, which get
+    //the log's format, text if it is off
+    if (trace_file) fwrite(e, sizeof(*e), 1, trace_file);
+    if (log_kinds[e->type].quiet) return;
+    int streams = atomic_load_explicit(&stream_count, memory_order_relaxed);
+    if (log_format == LOG_OFF && streams == 0) return;
+    char line[256];
+    log_print(e, log_format == LOG_JSON ? LOG_JSON : LOG_TEXT, line, sizeof(line));
+    if (log_format != LOG_OFF) fputs(line, stdout);
+    if (streams > 0) stream_line(line);
+}
 
-    int next = (current + 1) % proc_count;
-    int loop_count = 0;
+void log_print(log_event_t *e, int format, char *line, size_t size) {
+    //formats one event as a text or json line into line
+    log_kind_t *kind = &log_kinds[e->type];
+    double t = (e->time - batch_start) / 1e9;
+    size_t n;
+    if (format == LOG_JSON) {
+        n = snprintf(line, size, "{\"t\":%.6f,\"event\":\"%s\"", t, kind->name);
+        if (e->pid) n += snprintf(line + n, size - n, ",\"pid\":%d", e->pid);
+        if (e->slot >= 0) n += snprintf(line + n, size - n, ",\"slot\":%d", e->slot);
+        if (kind->a) n += snprintf(line + n, size - n, ",\"%s\":%lld", kind->a, e->a);
+        if (kind->b) n += snprintf(line + n, size - n, ",\"%s\":%lld", kind->b, e->b);
+        if (e->name[0]) {
+            //names are argv[0] basenames of at most 19 bytes, so quotes and backslashes are all that needs
+            //escaping and the line always has room
+            n += snprintf(line + n, size - n, ",\"name\":\"");
+            for (char *c = e->name; *c; c++) {
+                if (*c == '"' || *c == '\\') line[n++] = '\\';
+                line[n++] = *c;
+            }
+            line[n++] = '"';
+        }
+        snprintf(line + n, size - n, "}\n");
+        return;
+    }
+    n = snprintf(line, size, "MCP: %10.6f %-6s", t, kind->name);
+    if (e->pid) n += snprintf(line + n, size - n, " PID %d", e->pid);
+    if (e->slot >= 0) n += snprintf(line + n, size - n, " slot %d", e->slot);
+    if (kind->a) n += snprintf(line + n, size - n, " %s %lld", kind->a, e->a);
+    if (kind->b) n += snprintf(line + n, size - n, " %s %lld", kind->b, e->b);
+    if (e->name[0]) n += snprintf(line + n, size - n, " %s", e->name);
+    snprintf(line + n, size - n, "\n");
+}
 
-    while (processes[next].finished && loop_count < proc_count) {
-        next = (next + 1) % proc_count;
-        loop_count++;
+const char *skip_fields(const char *s, int count) {
+    //moves past count space separated fields
+    while (count-- > 0) {
+        while (*s == ' ') s++;
+        while (*s && *s != ' ') s++;
     }
+    return s;
+}
+
+unsigned long parse_ulong(const char **s) {
+    //parses the decimal number at *s and moves *s past it
+    const char *c = *s;
+    unsigned long value = 0;
+    while (*c == ' ') c++;
+    while (*c >= '0' && *c <= '9') value = value * 10 + (*c++ - '0');
+    *s = c;
+    return value;
+}
+
+int open_proc_file(pid_t pid, const char *name) {
+    //opens /proc/[pid]/name close-on-exec, -1 if it can't
+    //close-on-exec keeps the MCP's open /proc files out of the jobs it spawns
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/%s", pid, name);
+    return open(path, O_RDONLY | O_CLOEXEC);
+}
 
-    if (!processes[next].finished) {
-        current = next;
-        kill(processes[current].pid, SIGCONT);
-        printf("MCP: Running PID %d - %s\n", processes[current].pid, processes[current].cmd);
-        print_proc_stats(processes[current].pid);
-        alarm(TIME_SLICE);
+long long now_ns(void) {
+    //CLOCK_MONOTONIC in nanoseconds, or the virtual clock of a simulation
+    if (simulate) return sim_now;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+long long parse_size(const char *str) {
+    //parses "512M", "2G", "64k" into bytes, a bare number means bytes
+    char *end;
+    double value = strtod(str, &end);
+    if (end == str || value < 0) return -1;
+
+    double scale;
+    switch (*end) {
+    case '\0': scale = 1; break;
+    case 'k': case 'K': scale = 1024.0; break;
+    case 'm': case 'M': scale = 1024.0 * 1024; break;
+    case 'g': case 'G': scale = 1024.0 * 1024 * 1024; break;
+    case 't': case 'T': scale = 1024.0 * 1024 * 1024 * 1024; break;
+    default: return -1;
     }
+    if (*end && end[1] != '\0' && strcmp(end + 1, "B") != 0 && strcmp(end + 1, "iB") != 0) return -1;
+    return (long long)(value * scale);
 }
 
+char *parse_job_options(char *line, process_t *p, char **name, char **after) {
+    //strips leading key=value job options (e.g. "arrive=2s quantum=10ms weight=200 cpumax=0.5 ./cpubound"), returns the command
+    //cpu=30s rss=512M wall=60s nofile=1024 are limits, a job going over one is killed unless overrun=demote
+    //name= and after= are left for dag_link as *name and *after, NULL when absent
+    //any other key=value before the command is an unknown option: NULL, with job_error saying which
+    *name = NULL;
+    job_error[0] = '\0';
+    *after = NULL;
+    p->quantum = 0;
+    p->weight = DEFAULT_WEIGHT;
+    while (*line == ' ') line++;
+    p->cpu_max = 0;
+    p->mem_max = 0;
+    p->arrive = 0;
+    p->cpu_limit = p->rss_limit = p->wall_limit = 0;
+    p->nofile_limit = 0;
+    p->overrun_demote = 0;
+    while (strncmp(line, "cpu=", 4) == 0 || strncmp(line, "rss=", 4) == 0 || strncmp(line, "wall=", 5) == 0
+           || strncmp(line, "nofile=", 7) == 0 || strncmp(line, "overrun=", 8) == 0
+           || strncmp(line, "quantum=", 8) == 0 || strncmp(line, "weight=", 7) == 0
+           || strncmp(line, "cpumax=", 7) == 0 || strncmp(line, "memmax=", 7) == 0
+           || strncmp(line, "arrive=", 7) == 0 || strncmp(line, "name=", 5) == 0 || strncmp(line, "after=", 6) == 0) {
+        char *value = strchr(line, '=') + 1;
+        char *end = strchr(value, ' ');
+        if (end) *end = '\0';
+        if (strncmp(line, "cpu=", 4) == 0 || strncmp(line, "wall=", 5) == 0) {
+            long long *limit = line[0] == 'c' ? &p->cpu_limit : &p->wall_limit;
+            *limit = parse_duration(value);
+            if (*limit <= 0) {
+                job_warning("MCP: Ignoring invalid %s '%s'\n", line[0] == 'c' ? "cpu" : "wall", value);
+                *limit = 0;
+            }
+        } else if (line[0] == 'r') {
+            p->rss_limit = parse_size(value);
+            if (p->rss_limit <= 0) {
+                job_warning("MCP: Ignoring invalid rss '%s'\n", value);
+                p->rss_limit = 0;
+            }
+        } else if (strncmp(line, "nofile=", 7) == 0) {
+            p->nofile_limit = atol(value);
+            if (p->nofile_limit <= 0) {
+                job_warning("MCP: Ignoring invalid nofile '%s'\n", value);
+                p->nofile_limit = 0;
+            }
+        } else if (line[0] == 'o') {
+            p->overrun_demote = strcmp(value, "demote") == 0;
+            if (!p->overrun_demote && strcmp(value, "kill") != 0) {
+                job_warning("MCP: Ignoring invalid overrun '%s' (kill or demote)\n", value);
+            }
+        } else if (line[0] == 'q') {
+            p->quantum = parse_duration(value);
+            if (p->quantum <= 0) {
+                job_warning("MCP: Ignoring invalid quantum '%s'\n", value);
+                p->quantum = 0;
+            }
+        } else if (line[0] == 'w') {
+            p->weight = atoi(value);
+            if (p->weight <= 0) {
+                job_warning("MCP: Ignoring invalid weight '%s'\n", value);
+                p->weight = DEFAULT_WEIGHT;
+            }
+        } else if (line[0] == 'n') {
+            *name = value;
+        } else if (line[1] == 'f') {
+            *after = value;
+        } else if (line[0] == 'a') {
+            p->arrive = parse_duration(value);
+            if (p->arrive < 0) {
+                job_warning("MCP: Ignoring invalid arrive '%s'\n", value);
+                p->arrive = 0;
+            }
+        } else if (line[0] == 'c') {
+            p->cpu_max = atof(value);
+            if (p->cpu_max <= 0) {
+                job_warning("MCP: Ignoring invalid cpumax '%s' (share of one cpu, e.g. 0.5)\n", value);
+                p->cpu_max = 0;
+            }
+        } else {
+            p->mem_max = parse_size(value);
+            if (p->mem_max <= 0) {
+                job_warning("MCP: Ignoring invalid memmax '%s'\n", value);
+                p->mem_max = 0;
+            }
+        }
+        line = end ? end + 1 : value + strlen(value);
+        while (*line == ' ') line++;
+    }
+    //taken for the command it would only fail to exec, after its job had been spawned and scheduled
+    size_t key = strspn(line, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_");
+    if (key > 0 && line[key] == '=') {
+        snprintf(job_error, sizeof(job_error), "unknown job option '%.*s'", (int)strcspn(line, " "), line);
+        return NULL;
+    }
+    return line;
+}
+
+long long seconds_hint(const char *cmd) {
+    //value of a "-seconds N" argument in ns, 0 if absent (cpubound and iobound take one)
+    const char *arg = strstr(cmd, " -seconds ");
+    if (!arg) return 0;
+    return (long long)(atof(arg + 10) * NSEC_PER_SEC);
+}
+
+long long job_estimate(process_t *p) {
+    //expected run time, what the critical path is measured in: the -seconds hint, else one quantum
+    return p->hint ? p->hint : default_quantum;
+}
+
+void dag_link(process_t *p, char *name, char *after) {
+    //holds p on every after= job that hasn't finished and registers it under its name=
+    //after= can only name jobs of earlier lines, so the file is already in an order that runs and has no cycles
+    if (after) {
+        dag_used = 1;
+        for (char *dep = strtok(after, ","); dep; dep = strtok(NULL, ",")) {
+            dag_node_t *node = dag_lookup(dep);
+            if (!node) {
+                job_warning("MCP: Ignoring after '%s', no earlier job has that name\n", dep);
+                continue;
+            }
+            dag_node_t **grown = realloc(p->after, (p->after_count + 1) * sizeof(dag_node_t *));
+            if (!grown) {
+                perror("realloc");
+                exit(EXIT_FAILURE);
+            }
+            p->after = grown;
+            p->after[p->after_count++] = node;
+            node->refs++;
+            if (!node->job) {
+                if (node->failed) p->after_failed = 1;
+                continue;
+            }
+            if (node->waiter_count == node->waiter_capacity) {
+                node->waiter_capacity = node->waiter_capacity ? node->waiter_capacity * 2 : 4;
+                process_t **waiters = realloc(node->waiters, node->waiter_capacity * sizeof(process_t *));
+                if (!waiters) {
+                    perror("realloc");
+                    exit(EXIT_FAILURE);
+                }
+                node->waiters = waiters;
+            }
+            node->waiters[node->waiter_count++] = p;
+            p->waiting++;
+        }
+        dag_raise(p);
+    }
+    if (!name) return;
+    dag_node_t *old = dag_lookup(name);
+    if (old && old->job) {
+        job_warning("MCP: Ignoring duplicate name '%s', unfinished job %ld has it\n", name, old->job->serial);
+        return;
+    }
+    if (old) {
+        //finished: the name passes to p, jobs already after the old one keep their link to it
+        dag_remove(old);
+        dag_retire(old);
+    }
+    dag_node_t *node = calloc(1, sizeof(dag_node_t));
+    if (!node || !(node->name = strdup(name))) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    node->job = p;
+    p->node = node;
+    dag_insert(node);
+}
+
+static size_t name_hash(const char *name) {
+    //fnv-1a
+    size_t hash = 14695981039346656037ULL;
+    while (*name) hash = (hash ^ (unsigned char)*name++) * 1099511628211ULL;
+    return hash;
+}
+
+dag_node_t *dag_lookup(const char *name) {
+    //job registered under name=, NULL if none
+    if (dag_capacity == 0) return NULL;
+    size_t mask = dag_capacity - 1, i = name_hash(name) & mask;
+    while (dag_table[i]) {
+        if (strcmp(dag_table[i]->name, name) == 0) return dag_table[i];
+        i = (i + 1) & mask;
+    }
+    return NULL;
+}
+
+void dag_insert(dag_node_t *node) {
+    //registers a named job
+    if ((dag_entries + 1) * 2 > dag_capacity) {
+        dag_node_t **old = dag_table;
+        size_t old_capacity = dag_capacity;
+        dag_capacity = dag_capacity ? dag_capacity * 2 : 64;
+        dag_table = calloc(dag_capacity, sizeof(dag_node_t *));
+        if (!dag_table) {
+            perror("calloc");
+            exit(EXIT_FAILURE);
+        }
+        dag_entries = 0;
+        for (size_t i = 0; i < old_capacity; i++) {
+            if (old[i]) dag_insert(old[i]);
+        }
+        free(old);
+    }
+
+    size_t mask = dag_capacity - 1, i = name_hash(node->name) & mask;
+    while (dag_table[i]) i = (i + 1) & mask;
+    dag_table[i] = node;
+    node->listed = 1;
+    dag_entries++;
+}
+
+void dag_remove(dag_node_t *node) {
+    //takes a node out of the name table, by backward shift like pid_remove
+    size_t mask = dag_capacity - 1, i = name_hash(node->name) & mask;
+    while (dag_table[i] != node) i = (i + 1) & mask;
+    size_t hole = i;
+    for (i = (i + 1) & mask; dag_table[i]; i = (i + 1) & mask) {
+        size_t home = name_hash(dag_table[i]->name) & mask;
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            dag_table[hole] = dag_table[i];
+            hole = i;
+        }
+    }
+    dag_table[hole] = NULL;
+    node->listed = 0;
+    dag_entries--;
+}
+
+void dag_retire(dag_node_t *node) {
+    //frees a node nothing will read again: its job finished, no unfinished job is after it and no name
+    //leads to it; a batch keeps every finished name for the lines after it, a daemon, which never ends,
+    //keeps the DAG_RETAIN most recent ones and forgets the oldest as new ones finish
+    if (node->job || node->refs > 0) return;
+    if (node->listed) {
+        if (!listen_path || node->retained) return;
+        if (retain_count == DAG_RETAIN) {
+            dag_node_t *oldest = retained[retain_head];
+            retain_head = (retain_head + 1) % DAG_RETAIN;
+            retain_count--;
+            oldest->retained = 0;
+            if (oldest->refs == 0) {
+                if (oldest->listed) dag_remove(oldest);
+                dag_retire(oldest);
+            }
+            //one named again by a later after= comes back to the ring when that job finishes
+        }
+        retained[(retain_head + retain_count++) % DAG_RETAIN] = node;
+        node->retained = 1;
+        return;
+    }
+    if (node->retained) return; //the ring frees it in its turn
+    free(node->name);
+    free(node);
+}
+
+void dag_raise(process_t *p) {
+    //every unfinished job p runs after must rank at least its own estimate above p; a queued one is
+    //re-sorted under the critical policy, and the raise carries on up its own after= jobs
+    for (int i = 0; i < p->after_count; i++) {
+        process_t *q = p->after[i]->job;
+        if (!q || q->rank >= job_estimate(q) + p->rank) continue;
+        q->rank = job_estimate(q) + p->rank;
+        if (q->queued_on >= 0 && policy->enqueue == critical_enqueue) {
+            int slot = q->queued_on;
+            dequeue_process(q);
+            enqueue_process(slot, q);
+        }
+        dag_raise(q);
+    }
+}
+
+void dag_release(process_t *p) {
+    //p finished: records the longest chain of cpu time ending with it, and readies the jobs it was the
+    //last to hold; if it failed they are skipped once readied, and so are the jobs after them
+    long long path = 0;
+    for (int i = 0; i < p->after_count; i++) {
+        if (p->after[i]->path > path) path = p->after[i]->path;
+    }
+    path += p->cpu_ns; //not wall time, which includes waiting for a slot and would make any order look critical
+    if (path > longest_path) longest_path = path;
+    for (int i = 0; i < p->after_count; i++) {
+        p->after[i]->refs--;
+        dag_retire(p->after[i]);
+    }
+    free(p->after);
+    p->after = NULL;
+    p->after_count = 0;
+
+    dag_node_t *node = p->node;
+    if (!node) return;
+    node->job = NULL;
+    node->failed = p->failed;
+    node->path = path;
+    for (int i = 0; i < node->waiter_count; i++) {
+        process_t *q = node->waiters[i];
+        if (p->failed) q->after_failed = 1;
+        if (--q->waiting == 0) ready_push(q);
+    }
+    free(node->waiters);
+    node->waiters = NULL;
+    node->waiter_count = node->waiter_capacity = 0;
+    p->node = NULL;
+    dag_retire(node);
+}
+
+void ready_push(process_t *p) {
+    //queues a job whose after= jobs have all finished, highest rank first, for admit_jobs
+    process_t **at = &ready;
+    while (*at && (*at)->rank >= p->rank) at = &(*at)->job_next;
+    p->job_next = *at;
+    *at = p;
+}
+
+void print_summary(void) {
+    //makespan and mean turnaround, to compare policies
+    if (job_count == 0) return;
+    printf("MCP: Policy %s, %ld jobs, makespan %.3f s, mean turnaround %.3f s\n", policy->name, job_count,
+           (last_finish - batch_start) / 1e9, total_turnaround / 1e9 / job_count);
+    if (dag_used) printf("MCP: Critical path %.3f s, the longest after= chain of cpu time\n", longest_path / 1e9);
+    if (adapt_overhead > 0) {
+        printf("MCP: Adaptive quantum %.2f ms after %ld adjustments, switches cost %.0f us (%.2f%%)\n", default_quantum / 1e6,
+               adapt_count, switch_cost / 1e3, 100.0 * switch_cost / (switch_cost + default_quantum));
+    }
+}
+
+void schedule_slot(int slot, int expired) {
+    //stops the slot's process and continues the next waiting one on it
+    //an expired process is queued again before the pick so it competes with the others under the policy
+    slot_t *sl = &slots[slot];
+    process_t *prev = sl->running;
+
+    if (prev && expired) {
+        account_slice(prev);
+        if (!policy->preemptive) {
+            arm_timer(slot, slice_length(slot, prev), expired);
+            return;
+        }
+        if (prev->demoted) rq_push(&background, prev); //behind every job the policy queues, see pick_next
+        else enqueue_process(slot, prev);
+    }
+
+    process_t *p = pick_next(slot);
+    if (!p) return;
+
+    proc_stats_t stats;
+    if (p == prev) {
+        //still the best choice, keep it on the CPU for another slice
+        if (read_proc_stats(p, &stats) == 0) {
+            p->slice_cpu = stats.utime + stats.stime;
+            track_rss(p, stats.rss_kb);
+        }
+        p->slice_start = now_ns();
+        arm_timer(slot, slice_length(slot, p), expired);
+        return;
+    }
+
+    if (prev) {
+        suspend_job(prev);
+        prev->slot = -1;
+        prev->stopped_at = now_ns();
+        prev->stopped_quantum = default_quantum;
+        log_event(LOG_STOP, prev, slot, prev->cpu_ns / 1000000, (now_ns() - prev->slice_start) / 1000);
+    }
+
+    set_running(slot, p);
+    p->slot = slot;
+    p->last_slot = slot;
+    if (pin_slots) pin_to_slot(p->pid, slot);
+    resume_job(p);
+    p->slice_start = now_ns();
+    if (adapt_overhead > 0) record_switch(expired ? slot : -1, p);
+    if (read_proc_stats(p, &stats) == 0) {
+        p->slice_cpu = stats.utime + stats.stime;
+        track_rss(p, stats.rss_kb);
+    }
+    log_event(LOG_RUN, p, slot, p->slice_cpu * tick_ns / 1000000, p->rss_kb);
+    arm_timer(slot, slice_length(slot, p), expired);
+
+    if (prev) kick_idle_slots();
+}
+
+process_t *pick_next(int slot) {
+    //takes the next process off the slot's run queue, stealing from the busiest slot if it is empty
+    //and taking a demoted job only when there is nothing to steal
+    process_t *p = policy->pick_next(&slots[slot]);
+
+    if (!p) {
+        int victim = -1;
+        for (int i = 0; i < slot_count; i++) {
+            if (i != slot && slots[i].queued > 0 && (victim < 0 || slots[i].queued > slots[victim].queued)) {
+                victim = i;
+            }
+        }
+        if (victim < 0) {
+            //nothing waits anywhere else, so a demoted job gets the slot rather than leaving it idle
+            if ((p = background.head) != NULL) rq_remove(&background, p);
+            return p;
+        }
+        p = policy->steal(&slots[victim]);
+    }
+
+    dequeue_process(p);
+    return p;
+}
+
+void kick_idle_slots(void) {
+    //gives every idle slot a chance to steal work that was just queued
+    if (idle_slots == 0) return;
+    for (int i = 0; i < slot_count; i++) {
+        if (!slots[i].running) schedule_slot(i, 0);
+    }
+}
+
+void set_running(int slot, process_t *p) {
+    //records what the slot runs, keeping idle_slots in step
+    if (!slots[slot].running && p) idle_slots--;
+    if (slots[slot].running && !p) idle_slots++;
+    slots[slot].running = p;
+}
+
+static size_t pid_hash(pid_t pid) {
+    //fibonacci hashing, consecutive pids from a burst of forks spread over the table
+    return ((unsigned long long)pid * 11400714819323198485ULL) >> 32;
+}
+
+void pid_insert(process_t *p) {
+    //maps a child's pid to its job
+    if ((pid_entries + 1) * 2 > pid_capacity) {
+        //grow and rehash, the old table's entries are all still live
+        process_t **old = pid_table;
+        size_t old_capacity = pid_capacity;
+        pid_capacity = pid_capacity ? pid_capacity * 2 : 64;
+        pid_table = calloc(pid_capacity, sizeof(process_t *));
+        if (!pid_table) {
+            perror("calloc");
+            exit(EXIT_FAILURE);
+        }
+        pid_entries = 0;
+        for (size_t i = 0; i < old_capacity; i++) {
+            if (old[i]) pid_insert(old[i]);
+        }
+        free(old);
+    }
+
+    size_t mask = pid_capacity - 1, i = pid_hash(p->pid) & mask;
+    while (pid_table[i]) i = (i + 1) & mask;
+    pid_table[i] = p;
+    pid_entries++;
+}
+
+process_t *pid_lookup(pid_t pid) {
+    //job of the child with this pid, NULL if unknown
+    if (pid_capacity == 0) return NULL;
+    size_t mask = pid_capacity - 1, i = pid_hash(pid) & mask;
+    while (pid_table[i]) {
+        if (pid_table[i]->pid == pid) return pid_table[i];
+        i = (i + 1) & mask;
+    }
+    return NULL;
+}
+
+void pid_remove(pid_t pid) {
+    //forgets a reaped child
+    //backward-shift deletion: later entries of the probe run move up so lookups never need tombstones
+    if (pid_capacity == 0) return;
+    size_t mask = pid_capacity - 1, i = pid_hash(pid) & mask;
+    while (pid_table[i] && pid_table[i]->pid != pid) i = (i + 1) & mask;
+    if (!pid_table[i]) return;
+
+    size_t hole = i;
+    for (i = (i + 1) & mask; pid_table[i]; i = (i + 1) & mask) {
+        size_t home = pid_hash(pid_table[i]->pid) & mask;
+        //the entry can fill the hole unless its home bucket lies cyclically in (hole, i]
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            pid_table[hole] = pid_table[i];
+            hole = i;
+        }
+    }
+    pid_table[hole] = NULL;
+    pid_entries--;
+}
+
+void enqueue_process(int slot, process_t *p) {
+    //queues p on the slot through the policy
+    slot_t *sl = &slots[slot];
+    policy->enqueue(sl, p);
+    p->queued_on = slot;
+    sl->queued++;
+    sl->weight_sum += p->weight;
+}
+
+void dequeue_process(process_t *p) {
+    //takes p off whichever slot queues it
+    slot_t *sl = &slots[p->queued_on];
+    policy->dequeue(sl, p);
+    p->queued_on = -1;
+    sl->queued--;
+    sl->weight_sum -= p->weight;
+}
+
+long long slice_length(int slot, process_t *p) {
+    //quantum for p's next slice on slot
+    //--adaptive: a job that keeps blocking early gets about twice its bursts, so the slot isn't held while it
+    //sleeps, and never less than the overhead target allows; quantum= still fixes a job's own slice
+    long long quantum = policy->slice ? policy->slice(&slots[slot], p) : p->quantum ? p->quantum : default_quantum;
+    if (adapt_overhead > 0 && !p->quantum && p->burst_ns > 0) {
+        long long fit = 2 * p->burst_ns > adapt_floor ? 2 * p->burst_ns : adapt_floor;
+        if (fit < quantum) quantum = fit;
+    }
+    return quantum;
+}
+
+void account_slice(process_t *p) {
+    //charges the expired slice to p from /proc and tells the policy
+    //a process that was on the CPU for less than half of the slice blocked (iobound, sleep),
+    //one that spun through it (cpubound) used its whole quantum
+    proc_stats_t stats;
+    long long wall = now_ns() - p->slice_start;
+    long long cpu = wall;
+    if (read_proc_stats(p, &stats) == 0) {
+        track_rss(p, stats.rss_kb);
+        cpu = (long long)(stats.utime + stats.stime - p->slice_cpu) * tick_ns;
+        p->cpu_ns = (long long)(stats.utime + stats.stime) * tick_ns;
+        check_limits(p);
+    }
+    log_event(LOG_SAMPLE, p, p->slot, cpu / 1000, wall / 1000);
+
+    if (adapt_overhead > 0) {
+        //what it ran before blocking, a tick at least since /proc counts no finer; running through resets it
+        long long burst = cpu < tick_ns ? tick_ns : cpu;
+        if (cpu * 2 >= wall) p->burst_ns = 0;
+        else p->burst_ns = p->burst_ns ? (3 * p->burst_ns + burst) / 4 : burst;
+    }
+    if (cpu * 2 < wall) {
+        if (policy->on_block) policy->on_block(p, wall, cpu);
+    } else {
+        if (policy->on_tick) policy->on_tick(p, wall, cpu);
+    }
+}
+
+void boost_priorities(void) {
+    //mlfq: moves every waiting process back to the top level so demoted jobs can't starve
+    uint64_t expirations;
+    if (!simulate && read(boost_fd, &expirations, sizeof(expirations)) != sizeof(expirations)) return;
+
+    for (int i = 0; i < slot_count; i++) {
+        for (int level = 1; level < MLFQ_LEVELS; level++) {
+            while (slots[i].rq[level].head) {
+                process_t *p = slots[i].rq[level].head;
+                rq_remove(&slots[i].rq[level], p);
+                p->level = 0;
+                rq_push(&slots[i].rq[0], p);
+            }
+        }
+        if (slots[i].running) slots[i].running->level = 0;
+    }
+    log_event(LOG_BOOST, NULL, -1, 0, 0);
+}
+
+void list_enqueue(slot_t *sl, process_t *p) {
+    rq_push(&sl->rq[p->level], p);
+}
+
+void list_dequeue(slot_t *sl, process_t *p) {
+    rq_remove(&sl->rq[p->level], p);
+}
+
+process_t *list_head(slot_t *sl) {
+    //fifo and rr: the process that has waited longest
+    return sl->rq[0].head;
+}
+
+process_t *list_tail(slot_t *sl) {
+    //the newest arrival has the longest wait ahead of it on sl, so it gains the most from moving
+    return sl->rq[0].tail;
+}
+
+process_t *mlfq_pick(slot_t *sl) {
+    //head of the highest non-empty level
+    for (int level = 0; level < MLFQ_LEVELS; level++) {
+        if (sl->rq[level].head) return sl->rq[level].head;
+    }
+    return NULL;
+}
+
+process_t *mlfq_steal(slot_t *sl) {
+    //tail of the lowest non-empty level
+    for (int level = MLFQ_LEVELS - 1; level >= 0; level--) {
+        if (sl->rq[level].tail) return sl->rq[level].tail;
+    }
+    return NULL;
+}
+
+void mlfq_tick(process_t *p, long long wall, long long cpu) {
+    //used its whole quantum: drop to a longer, lower-priority one
+    //blocked processes (on_block) keep their level
+    (void)wall;
+    if (p->level < MLFQ_LEVELS - 1) {
+        p->level++;
+        log_event(LOG_DEMOTE, p, p->slot, cpu / 1000, p->level);
+    }
+}
+
+long long mlfq_slice(slot_t *sl, process_t *p) {
+    //level n runs for quantum << n
+    (void)sl;
+    long long quantum = p->quantum ? p->quantum : default_quantum;
+    return quantum << p->level;
+}
+
+process_t *lottery_pick(slot_t *sl) {
+    //draws a ticket, each process holds weight of them
+    if (sl->weight_sum <= 0) return sl->rq[0].head;
+    long ticket = random() % sl->weight_sum;
+    for (process_t *p = sl->rq[0].head; p; p = p->rq_next) {
+        ticket -= p->weight;
+        if (ticket < 0) return p;
+    }
+    return sl->rq[0].tail;
+}
+
+void tree_enqueue(slot_t *sl, process_t *p) {
+    //stride and cfs: a process that slept or moved from another slot starts at the slot's current
+    //key instead of keeping an old, small one that would let it monopolise the slot
+    if (p->key < sl->min_key) p->key = sl->min_key;
+    rb_insert(&sl->tree, p);
+}
+
+void tree_dequeue(slot_t *sl, process_t *p) {
+    rb_erase(&sl->tree, p);
+}
+
+process_t *tree_pick(slot_t *sl) {
+    //smallest key runs next
+    process_t *p = rb_first(&sl->tree);
+    if (p && p->key > sl->min_key) sl->min_key = p->key;
+    return p;
+}
+
+process_t *tree_steal(slot_t *sl) {
+    //largest key, the process sl would run last
+    return rb_last(&sl->tree);
+}
+
+void srtf_enqueue(slot_t *sl, process_t *p) {
+    //key is the estimated cpu time left: the -seconds hint, else the mean of earlier runs of the
+    //same command, else the mean of every finished command, else one default quantum
+    long long estimate = p->hint;
+    if (estimate == 0) {
+        char name[64];
+        long long total = 0;
+        int runs = 0;
+        sscanf(p->cmd, "%63s", name);
+        for (int i = 0; i < history_count; i++) {
+            if (strcmp(history[i].name, name) == 0) {
+                estimate = history[i].total_ns / history[i].runs;
+                break;
+            }
+            total += history[i].total_ns;
+            runs += history[i].runs;
+        }
+        if (estimate == 0) estimate = runs > 0 ? total / runs : default_quantum;
+    }
+    p->key = estimate - p->cpu_ns;
+    rb_insert(&sl->tree, p);
+}
+
+void srtf_exit(process_t *p) {
+    //learns the command's cpu time for later estimates
+    char name[64];
+    sscanf(p->cmd, "%63s", name);
+    for (int i = 0; i < history_count; i++) {
+        if (strcmp(history[i].name, name) == 0) {
+            history[i].total_ns += p->cpu_ns;
+            history[i].runs++;
+            return;
+        }
+    }
+    if (history_count == HISTORY_SIZE) return;
+    strcpy(history[history_count].name, name);
+    history[history_count].total_ns = p->cpu_ns;
+    history[history_count].runs = 1;
+    history_count++;
+}
+
+void stride_tick(process_t *p, long long wall, long long cpu) {
+    //every slice advances the pass by the stride, which shrinks as the weight grows
+    (void)wall;
+    (void)cpu;
+    p->key += STRIDE1 / p->weight;
+}
+
+void cfs_tick(process_t *p, long long wall, long long cpu) {
+    //vruntime grows with the time the process held the slot, scaled down by its weight
+    (void)cpu;
+    p->key += wall * DEFAULT_WEIGHT / p->weight;
+}
+
+long long cfs_slice(slot_t *sl, process_t *p) {
+    //splits CFS_LATENCY quanta between the slot's processes by weight, but never below one quantum: with more
+    //jobs waiting than that, each gets the quantum and weights act through vruntime alone, like the kernel's
+    //minimum granularity, instead of every job's slice shrinking and the switches multiplying with the load
+    long long latency = CFS_LATENCY * default_quantum;
+    long long slice = latency * p->weight / (sl->weight_sum + p->weight);
+    return slice < default_quantum ? default_quantum : slice;
+}
+
+void critical_enqueue(slot_t *sl, process_t *p) {
+    //the job with the longest chain of work still behind it runs first, so the batch can't take less
+    //than that chain but needn't take much more
+    p->key = -p->rank;
+    rb_insert(&sl->tree, p);
+}
+
+void rq_push(runqueue_t *rq, process_t *p) {
+    //appends p at the tail
+    p->rq_next = NULL;
+    p->rq_prev = rq->tail;
+    if (rq->tail) rq->tail->rq_next = p;
+    else rq->head = p;
+    rq->tail = p;
+    rq->length++;
+}
+
+void rq_remove(runqueue_t *rq, process_t *p) {
+    //unlinks p from anywhere in the queue
+    if (p->rq_prev) p->rq_prev->rq_next = p->rq_next;
+    else rq->head = p->rq_next;
+    if (p->rq_next) p->rq_next->rq_prev = p->rq_prev;
+    else rq->tail = p->rq_prev;
+    p->rq_prev = p->rq_next = NULL;
+    rq->length--;
+}
+
+static int rb_less(process_t *a, process_t *b) {
+    //ties are broken by address so every key is unique
+    return a->key < b->key || (a->key == b->key && a < b);
+}
+
+static void rb_replace_child(rbtree_t *tree, process_t *parent, process_t *old, process_t *new) {
+    if (!parent) tree->root = new;
+    else if (parent->rb_left == old) parent->rb_left = new;
+    else parent->rb_right = new;
+    if (new) new->rb_parent = parent;
+}
+
+static void rb_rotate_left(rbtree_t *tree, process_t *x) {
+    process_t *y = x->rb_right;
+    x->rb_right = y->rb_left;
+    if (y->rb_left) y->rb_left->rb_parent = x;
+    rb_replace_child(tree, x->rb_parent, x, y);
+    y->rb_left = x;
+    x->rb_parent = y;
+}
+
+static void rb_rotate_right(rbtree_t *tree, process_t *x) {
+    process_t *y = x->rb_left;
+    x->rb_left = y->rb_right;
+    if (y->rb_right) y->rb_right->rb_parent = x;
+    rb_replace_child(tree, x->rb_parent, x, y);
+    y->rb_right = x;
+    x->rb_parent = y;
+}
+
+void rb_insert(rbtree_t *tree, process_t *p) {
+    //adds p in key order
+    process_t *parent = NULL, **link = &tree->root;
+    while (*link) {
+        parent = *link;
+        link = rb_less(p, parent) ? &parent->rb_left : &parent->rb_right;
+    }
+    p->rb_parent = parent;
+    p->rb_left = p->rb_right = NULL;
+    p->rb_red = 1;
+    *link = p;
+
+    while ((parent = p->rb_parent) && parent->rb_red) {
+        process_t *grand = parent->rb_parent;
+        if (parent == grand->rb_left) {
+            process_t *uncle = grand->rb_right;
+            if (uncle && uncle->rb_red) {
+                parent->rb_red = uncle->rb_red = 0;
+                grand->rb_red = 1;
+                p = grand;
+                continue;
+            }
+            if (p == parent->rb_right) {
+                rb_rotate_left(tree, parent);
+                p = parent;
+                parent = p->rb_parent;
+            }
+            parent->rb_red = 0;
+            grand->rb_red = 1;
+            rb_rotate_right(tree, grand);
+        } else {
+            process_t *uncle = grand->rb_left;
+            if (uncle && uncle->rb_red) {
+                parent->rb_red = uncle->rb_red = 0;
+                grand->rb_red = 1;
+                p = grand;
+                continue;
+            }
+            if (p == parent->rb_left) {
+                rb_rotate_right(tree, parent);
+                p = parent;
+                parent = p->rb_parent;
+            }
+            parent->rb_red = 0;
+            grand->rb_red = 1;
+            rb_rotate_left(tree, grand);
+        }
+    }
+    tree->root->rb_red = 0;
+}
+
+void rb_erase(rbtree_t *tree, process_t *p) {
+    //removes p, rebalancing the tree
+    process_t *child, *parent;
+    int removed_red;
+
+    if (!p->rb_left || !p->rb_right) {
+        child = p->rb_left ? p->rb_left : p->rb_right;
+        parent = p->rb_parent;
+        removed_red = p->rb_red;
+        rb_replace_child(tree, parent, p, child);
+    } else {
+        //swap in the successor, then fix up from where the successor used to be
+        process_t *next = p->rb_right;
+        while (next->rb_left) next = next->rb_left;
+        removed_red = next->rb_red;
+        child = next->rb_right;
+        if (next->rb_parent == p) {
+            parent = next;
+        } else {
+            parent = next->rb_parent;
+            rb_replace_child(tree, parent, next, child);
+            next->rb_right = p->rb_right;
+            next->rb_right->rb_parent = next;
+        }
+        rb_replace_child(tree, p->rb_parent, p, next);
+        next->rb_left = p->rb_left;
+        next->rb_left->rb_parent = next;
+        next->rb_red = p->rb_red;
+    }
+    p->rb_parent = p->rb_left = p->rb_right = NULL;
+    if (removed_red) return;
+
+    while (child != tree->root && (!child || !child->rb_red)) {
+        if (child == parent->rb_left) {
+            process_t *sibling = parent->rb_right;
+            if (sibling->rb_red) {
+                sibling->rb_red = 0;
+                parent->rb_red = 1;
+                rb_rotate_left(tree, parent);
+                sibling = parent->rb_right;
+            }
+            if ((!sibling->rb_left || !sibling->rb_left->rb_red) && (!sibling->rb_right || !sibling->rb_right->rb_red)) {
+                sibling->rb_red = 1;
+                child = parent;
+                parent = child->rb_parent;
+            } else {
+                if (!sibling->rb_right || !sibling->rb_right->rb_red) {
+                    sibling->rb_left->rb_red = 0;
+                    sibling->rb_red = 1;
+                    rb_rotate_right(tree, sibling);
+                    sibling = parent->rb_right;
+                }
+                sibling->rb_red = parent->rb_red;
+                parent->rb_red = 0;
+                if (sibling->rb_right) sibling->rb_right->rb_red = 0;
+                rb_rotate_left(tree, parent);
+                child = tree->root;
+            }
+        } else {
+            process_t *sibling = parent->rb_left;
+            if (sibling->rb_red) {
+                sibling->rb_red = 0;
+                parent->rb_red = 1;
+                rb_rotate_right(tree, parent);
+                sibling = parent->rb_left;
+            }
+            if ((!sibling->rb_left || !sibling->rb_left->rb_red) && (!sibling->rb_right || !sibling->rb_right->rb_red)) {
+                sibling->rb_red = 1;
+                child = parent;
+                parent = child->rb_parent;
+            } else {
+                if (!sibling->rb_left || !sibling->rb_left->rb_red) {
+                    sibling->rb_right->rb_red = 0;
+                    sibling->rb_red = 1;
+                    rb_rotate_left(tree, sibling);
+                    sibling = parent->rb_left;
+                }
+                sibling->rb_red = parent->rb_red;
+                parent->rb_red = 0;
+                if (sibling->rb_left) sibling->rb_left->rb_red = 0;
+                rb_rotate_right(tree, parent);
+                child = tree->root;
+            }
+        }
+    }
+    if (child) child->rb_red = 0;
+}
+
+process_t *rb_first(rbtree_t *tree) {
+    //smallest key, NULL if empty
+    process_t *p = tree->root;
+    while (p && p->rb_left) p = p->rb_left;
+    return p;
+}
+
+process_t *rb_last(rbtree_t *tree) {
+    //largest key, NULL if empty
+    process_t *p = tree->root;
+    while (p && p->rb_right) p = p->rb_right;
+    return p;
+}
+
+void pin_to_slot(pid_t pid, int slot) {
+    //restricts pid to the slot's core when --pin is set
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(slots[slot].cpu, &set);
+    if (sched_setaffinity(pid, sizeof(set), &set) < 0) {
+        perror("sched_setaffinity");
+    }
+}
+
+void setup_slots(void) {
+    //allocates the slots and picks the core each one is pinned to
+    cpu_set_t allowed;
+
+    if (slot_count == 0) {
+        slot_count = sysconf(_SC_NPROCESSORS_ONLN);
+        if (slot_count <= 0) slot_count = 1;
+    }
+    slots = calloc(slot_count, sizeof(slot_t));
+    if (!slots) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+
+    //slot i is pinned to the i-th core the MCP itself may use, wrapping if there are more slots than cores
+    CPU_ZERO(&allowed);
+    sched_getaffinity(0, sizeof(allowed), &allowed);
+    int ncpu = CPU_COUNT(&allowed), cpu = -1;
+    for (int i = 0; i < slot_count; i++) {
+        do {
+            cpu = (cpu + 1) % CPU_SETSIZE;
+        } while (ncpu > 0 && !CPU_ISSET(cpu, &allowed));
+        slots[i].running = NULL;
+        idle_slots++;
+        slots[i].cpu = cpu;
+    }
+}
+
+void setup_event_loop(void) {
+    //creates the epoll instance, the SIGCHLD signalfd and one quantum timerfd per slot
+    struct epoll_event ev;
+
+    sigemptyset(&loop_mask);
+    sigaddset(&loop_mask, SIGCHLD);
+    if (listen_path) {
+        //a daemon shuts down cleanly, removing its socket, instead of dying on them
+        sigaddset(&loop_mask, SIGTERM);
+        sigaddset(&loop_mask, SIGINT);
+    }
+    if (sigprocmask(SIG_BLOCK, &loop_mask, NULL) < 0) {
+        perror("sigprocmask");
+        exit(EXIT_FAILURE);
+    }
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    signal_fd = signalfd(-1, &loop_mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (epoll_fd < 0 || signal_fd < 0) {
+        perror("setup_event_loop");
+        exit(EXIT_FAILURE);
+    }
+
+    setup_slots();
+    ev.events = EPOLLIN;
+    for (int i = 0; i < slot_count; i++) {
+        slots[i].timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (slots[i].timer_fd < 0) {
+            perror("timerfd_create");
+            exit(EXIT_FAILURE);
+        }
+        ev.data.u32 = EV_TIMER + i;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, slots[i].timer_fd, &ev);
+    }
+
+    ev.data.u32 = EV_SIGNAL;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, signal_fd, &ev);
+    arrival_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (arrival_fd < 0) {
+        perror("timerfd_create");
+        exit(EXIT_FAILURE);
+    }
+    ev.data.u32 = EV_ARRIVE;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, arrival_fd, &ev);
+    limit_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (limit_fd < 0) {
+        perror("timerfd_create");
+        exit(EXIT_FAILURE);
+    }
+    ev.data.u32 = EV_LIMIT;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, limit_fd, &ev);
+
+    tick_ns = NSEC_PER_SEC / sysconf(_SC_CLK_TCK);
+    page_kb = sysconf(_SC_PAGESIZE) / 1024;
+    if (strcmp(policy->name, "mlfq") == 0) {
+        //periodic, so the kernel keeps the boost cadence no matter how busy the loop is
+        struct itimerspec its;
+        its.it_value.tv_sec = boost_interval / NSEC_PER_SEC;
+        its.it_value.tv_nsec = boost_interval % NSEC_PER_SEC;
+        its.it_interval = its.it_value;
+        boost_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (boost_fd < 0 || timerfd_settime(boost_fd, 0, &its, NULL) < 0) {
+            perror("boost timer");
+            exit(EXIT_FAILURE);
+        }
+        ev.data.u32 = EV_BOOST;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, boost_fd, &ev);
+    }
+
+    //stdin is optional: epoll refuses regular files and /dev/null, so only register it when it can block
+    ev.data.u32 = EV_CONTROL;
+    control_open = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, STDIN_FILENO, &ev) == 0;
+}
+
+void arm_timer(int slot, long long quantum, int expired) {
+    //starts a new time slice on the slot's timerfd
+    //slices that follow an expiry are chained off the previous absolute deadline, so time the
+    //MCP spends late in the event loop comes out of the next slice instead of accumulating
+    slot_t *sl = &slots[slot];
+    long long now = now_ns();
+    if (expired && sl->slice_deadline + quantum > now) {
+        sl->slice_deadline += quantum;
+    } else {
+        sl->slice_deadline = now + quantum;
+    }
+    if (simulate) {
+        sim_push(SIM_TIMER, sl->slice_deadline, slot, 0, ++sl->timer_seq);
+        return;
+    }
+
+    struct itimerspec its = {0};
+    its.it_value.tv_sec = sl->slice_deadline / NSEC_PER_SEC;
+    its.it_value.tv_nsec = sl->slice_deadline % NSEC_PER_SEC;
+    timerfd_settime(sl->timer_fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+void arm_arrival(long long when) {
+    //wakes the loop when the next job of the file is submitted, admit_jobs then picks it up
+    if (simulate) {
+        sim_push(SIM_ARRIVE, when, -1, 0, 0);
+        return;
+    }
+    struct itimerspec its = {0};
+    its.it_value.tv_sec = when / NSEC_PER_SEC;
+    its.it_value.tv_nsec = when % NSEC_PER_SEC;
+    timerfd_settime(arrival_fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+void handle_timer_event(int slot) {
+    //the slot's time slice expired
+    uint64_t expirations;
+    if (read(slots[slot].timer_fd, &expirations, sizeof(expirations)) != sizeof(expirations)) return;
+    schedule_slot(slot, 1);
+}
+
+void apply_limits(process_t *p) {
+    //arms a freshly spawned job's wall= deadline; its rlimits were set in the child by exec_launcher
+    if (p->wall_limit > 0) {
+        long long deadline = p->spawned_at + p->wall_limit;
+        if (limit_deadline == 0 || deadline < limit_deadline) arm_limit(deadline);
+    }
+}
+
+void check_limits(process_t *p) {
+    //compares p's latest sample with its cpu= and rss=; it runs wherever a sample lands, so a job is
+    //checked every slice it runs and on every bulk refresh, for two compares and no reads of its own
+    if (p->killed) return;
+    if (p->rss_limit > 0 && p->rss_kb * 1024LL > p->rss_limit) over_limit(p, "rss");
+    else if (p->cpu_limit > 0 && !p->demoted && p->cpu_ns > p->cpu_limit) over_limit(p, "cpu");
+}
+
+void over_limit(process_t *p, const char *which) {
+    //kills p; with overrun=demote a job over cpu= or wall= is instead taken out of the policy's queues
+    //and runs only on slots with nothing else to do, while rss= always kills, demoting frees no memory
+    if (p->overrun_demote && strcmp(which, "rss") != 0) {
+        printf("MCP: Job %ld over its %s= limit, demoted: '%s'\n", p->serial, which, p->cmd);
+        p->demoted = 1;
+        if (p->queued_on >= 0) {
+            dequeue_process(p);
+            rq_push(&background, p);
+        }
+        return; //a running job goes to background when its slice ends
+    }
+    printf("MCP: Job %ld over its %s= limit, killed: '%s'\n", p->serial, which, p->cmd);
+    p->killed = 1;
+    kill_job(p); //reaped like any other exit, and counted as failed
+}
+
+void kill_job(process_t *p) {
+    //SIGKILL, to the whole cgroup with --cgroup; a stopped or frozen job dies all the same
+    if (p->cgroup_fd < 0 || cgroup_write(p->cgroup_fd, "cgroup.kill", "1") < 0) kill(p->pid, SIGKILL);
+}
+
+void arm_limit(long long when) {
+    //wakes the loop at the earliest wall= deadline, or disarms the timer when when is 0
+    struct itimerspec its = {0};
+    limit_deadline = when;
+    its.it_value.tv_sec = when / NSEC_PER_SEC;
+    its.it_value.tv_nsec = when % NSEC_PER_SEC;
+    timerfd_settime(limit_fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+void handle_limit_event(void) {
+    //a wall= deadline passed: acts on every job past its own and re-arms for the next one
+    //one timer serves every job, so jobs are scanned only when a deadline expires, never per tick
+    uint64_t expirations;
+    if (read(limit_fd, &expirations, sizeof(expirations)) != sizeof(expirations)) return;
+    long long now = now_ns(), next = 0;
+    for (process_t *p = jobs; p; p = p->job_next) {
+        if (p->wall_limit == 0 || p->killed || p->demoted) continue;
+        long long deadline = p->spawned_at + p->wall_limit;
+        if (deadline <= now) over_limit(p, "wall");
+        else if (next == 0 || deadline < next) next = deadline;
+    }
+    arm_limit(next);
+}
+
+void record_switch(int slot, process_t *p) {
+    //measures the switch that just put p on the slot (-1 if the slot was idle) and the wait p had
+    //the cost is the slot's time from the deadline of the slice that expired to p running: the timer's
+    //lateness, the sample, SIGSTOP and SIGCONT (or the freeze and thaw), all of it lost to every job
+    //a wait is kept in thousandths of the quantum when it began, since waits grow with the quantum,
+    //so the histogram says what any quantum would give; a demoted job's waits are meant to be long
+    if (slot >= 0) {
+        long long cost = p->slice_start - slots[slot].slice_deadline;
+        if (cost < 0) cost = 0;
+        switch_cost = switch_cost ? (7 * switch_cost + cost) / 8 : cost;
+    }
+    if (p->demoted || p->stopped_at == 0) return;
+    record_latency(&wait_hist, (p->slice_start - p->stopped_at) * 1000 / p->stopped_quantum);
+    //the window starts at four waits and doubles, so even a -q of seconds is corrected within a few slices
+    if (++adapt_samples >= (adapt_count < 3 ? 4 << adapt_count : ADAPT_SAMPLES)) adapt_quantum();
+}
+
+void adapt_quantum(void) {
+    //retunes the quantum: the longest one whose p99 wait meets the response target, as that switches least,
+    //but never one so short that switching takes more than the overhead target of each slot; the overhead
+    //target wins when the two conflict, and without a response target the quantum is simply that shortest one
+    //each step moves at most ADAPT_STEP times, and the history is halved so newer waits count more
+    double share = adapt_overhead / 100;
+    long long shortest = (long long)(switch_cost * (1 - share) / share); //cost / (cost + quantum) = share
+    if (shortest < ADAPT_MIN) shortest = ADAPT_MIN;
+    long long quantum = shortest;
+    if (adapt_response > 0) {
+        long long wait = latency_percentile(&wait_hist, 99); //thousandths of a quantum
+        quantum = wait > 0 ? adapt_response * 1000 / wait : ADAPT_MAX;
+        if (quantum < shortest) quantum = shortest;
+    }
+    if (quantum > default_quantum * ADAPT_STEP) quantum = default_quantum * ADAPT_STEP;
+    if (quantum < default_quantum / ADAPT_STEP) quantum = default_quantum / ADAPT_STEP;
+    if (quantum < ADAPT_MIN) quantum = ADAPT_MIN;
+    if (quantum > ADAPT_MAX) quantum = ADAPT_MAX;
+    default_quantum = quantum;
+    adapt_floor = shortest;
+    adapt_count++;
+
+    adapt_samples = 0;
+    histogram_halve(&wait_hist);
+}
+
+void handle_signal_event(void) {
+    //SIGCHLD arrived, reap every exited child; for a daemon SIGTERM or SIGINT, stop accepting jobs
+    struct signalfd_siginfo info;
+    while (read(signal_fd, &info, sizeof(info)) == sizeof(info)) {
+        //drain, several exits can collapse into one pending SIGCHLD
+        if (info.ssi_signo != SIGCHLD) stop_listening();
+    }
+
+    int status;
+    pid_t pid;
+    struct rusage usage;
+    while ((pid = wait4(-1, &status, WNOHANG, &usage)) > 0) {
+        process_t *p = pid_lookup(pid);
+        if (!p) continue;
+        pid_remove(pid);
+        p->failed = !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+        p->cpu_ns = (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * NSEC_PER_SEC
+                  + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1000LL;
+        finish_job(p);
+    }
+}
+
+void finish_job(process_t *p) {
+    //logs a finished job, hands its slot to the next one and releases it
+    p->finished_at = now_ns();
+    drain_output(p, 0, 1); //what it wrote just before exiting
+    drain_output(p, 1, 1);
+    log_event(LOG_EXIT, p, p->slot, p->cpu_ns / 1000000, (p->finished_at - p->submitted_at) / 1000000);
+    if (p->queued_on >= 0) dequeue_process(p);
+    else if (p->demoted && p->slot < 0) rq_remove(&background, p);
+    if (policy->on_exit) policy->on_exit(p);
+    if (p->slot >= 0) {
+        //hand the slot to the next job now instead of idling out the rest of the slice
+        int slot = p->slot;
+        set_running(slot, NULL);
+        p->slot = -1;
+        schedule_slot(slot, 0);
+    }
+    free_job(p);
+}
+
+void handle_output_event(unsigned tag) {
+    //a job wrote to its stdout or stderr pipe, the tag names which
+    process_t *p = pid_lookup(tag & ~(EV_OUTPUT | EV_STDERR));
+    if (p) drain_output(p, (tag & EV_STDERR) != 0, 0);
+}
+
+void handle_control_event(void) {
+    //a command line arrived on stdin
+    char buffer[CONTROL_MAX];
+    ssize_t n = read(STDIN_FILENO, buffer, sizeof(buffer) - 1);
+    if (n <= 0) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, STDIN_FILENO, NULL);
+        control_open = 0;
+        return;
+    }
+    buffer[n] = '\0';
+    trim_newline(buffer);
+    run_command(buffer, -1);
+}
+
+void run_command(char *line, int client) {
+    //runs a control command from stdin (client -1) or a daemon client: "status" lists jobs, "quit" kills
+    //them all, "tail <serial>" shows a job's last output with --output; a daemon also takes
+    //"submit <job line>", "cancel <serial>", "stream" and "shutdown"
+    //a client's command ends with a line "ok", or "ok <serial>" for submit, or one "error <reason>"
+    if (strcmp(line, "status") == 0) {
+        refresh_accounting();
+        for (process_t *p = jobs; p; p = p->job_next) {
+            reply(client, "MCP: Job %ld PID %d %-8s slot %2d cpu %7.2f s rss %7ld kB", p->serial, p->pid,
+                  p->slot >= 0 ? "running" : p->demoted ? "demoted" : "stopped", p->last_slot, p->cpu_ns / 1e9, p->rss_kb);
+            if (p->io_bytes >= 0) reply(client, " io %7lld kB", p->io_bytes / 1024);
+            if (output_dir) reply(client, " out %7lld kB", (p->out_bytes[0] + p->out_bytes[1]) / 1024);
+            reply(client, " %s\n", p->cmd);
+        }
+        reply(client, "MCP: %d jobs sampled from %s in %.2f ms\n", live_count, use_taskstats ? "taskstats" : "/proc", refresh_cost / 1e6);
+        if (held_count > 0) reply(client, "MCP: %d jobs held by after=\n", held_count);
+        if (sample_count > 0) reply(client, "MCP: %ld /proc samples, %.2f us each\n", sample_count, sample_ns / 1e3 / sample_count);
+        if (adapt_overhead > 0) {
+            reply(client, "MCP: Adaptive quantum %.2f ms, switches cost %.0f us (%.2f%%), p99 wait %.2f quanta\n",
+                  default_quantum / 1e6, switch_cost / 1e3, 100.0 * switch_cost / (switch_cost + default_quantum),
+                  wait_hist.total ? latency_percentile(&wait_hist, 99) / 1000.0 : 0);
+        }
+    } else if (strcmp(line, "quit") == 0) {
+        //with --cgroup one write kills every job and everything they started; the rest of the file is
+        //never read, what was read or submitted but not started is skipped, and a daemon stops as well
+        if (group_fd < 0 || cgroup_write(group_fd, "cgroup.kill", "1") < 0) {
+            for (process_t *p = jobs; p; p = p->job_next) {
+                kill(p->pid, SIGKILL);
+            }
+        }
+        cancel_pending();
+        if (listen_path) stop_listening();
+    } else if (output_dir && strncmp(line, "tail ", 5) == 0) {
+        print_tail(atol(line + 5), client);
+        return;
+    } else if (listen_path && strncmp(line, "submit ", 7) == 0) {
+        submit_job(line + 7, client);
+        return;
+    } else if (listen_path && strncmp(line, "cancel ", 7) == 0) {
+        cancel_job(atol(line + 7), client);
+        return;
+    } else if (listen_path && strcmp(line, "stream") == 0 && client >= 0) {
+        //from now on the drain copies every log line, and the client only reads; the copying starts
+        //once the "ok" and any replies before it have been sent, so no log line overtakes them
+        reply(client, "ok\n");
+        clients[client].watching = 1;
+        if (clients[client].pending_length == 0) client_stream(client);
+        return;
+    } else if (listen_path && strcmp(line, "shutdown") == 0) {
+        stop_listening(); //the jobs already taken still run to the end
+    } else if (line[0] != '\0') {
+        if (client < 0) printf("MCP: Unknown command '%s' (%s%s)\n", line, listen_path ? "status, submit, cancel, shutdown, quit" : "status, quit",
+                               output_dir ? ", tail" : "");
+        else reply(client, "error unknown command '%s' (status, submit, cancel, stream, shutdown, quit%s)\n", line, output_dir ? ", tail" : "");
+        return;
+    }
+    if (client >= 0) reply(client, "ok\n");
+}
+
+void run_event_loop(void) {
+    //dispatches events until every process has finished, and a daemon has stopped listening
+    struct epoll_event events[MAX_EVENTS];
+
+    while (1) {
+        //admission happens between events so a freed place in the window is refilled immediately
+        //the first pass admits the first window, and kicking the idle slots starts their slices right away
+        if (more_jobs() && live_count < admit_window) admit_jobs();
+        if (live_count == 0 && !more_jobs() && listen_fd < 0) break;
+        fflush(stdout);
+        int n = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            exit(EXIT_FAILURE);
+        }
+        for (int i = 0; i < n; i++) {
+            switch (events[i].data.u32) {
+            case EV_SIGNAL:  handle_signal_event();  break;
+            case EV_CONTROL: handle_control_event(); break;
+            case EV_BOOST:   boost_priorities();     break;
+            case EV_LISTEN:  handle_listen_event();  break;
+            case EV_LIMIT:   handle_limit_event();   break;
+            case EV_ARRIVE: {
+                uint64_t expirations; //admission at the top of the loop takes the job that arrived
+                if (read(arrival_fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN) perror("arrival timer");
+                break;
+            }
+            default:
+                if (events[i].data.u32 & EV_CLIENT) handle_client_event(events[i].data.u32 & ~EV_CLIENT, events[i].events);
+                else if (events[i].data.u32 & EV_OUTPUT) handle_output_event(events[i].data.u32);
+                else handle_timer_event(events[i].data.u32 - EV_TIMER);
+                break;
+            }
+        }
+    }
+}
+
+int more_jobs(void) {
+    //whether jobs are left to admit: the rest of the file, ready ones or daemon submissions
+    return job_file || arriving || ready || submitted;
+}
+
+void setup_listener(void) {
+    //binds the --listen socket and adds it to the event loop
+    //a socket file left by a daemon that died is replaced, one that still answers is not
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    struct epoll_event ev = { .events = EPOLLIN, .data.u32 = EV_LISTEN };
+    if (strlen(listen_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path '%s' is too long\n", listen_path);
+        exit(EXIT_FAILURE);
+    }
+    strcpy(addr.sun_path, listen_path);
+    for (int i = 0; i < MAX_CLIENTS; i++) clients[i].fd = -1;
+
+    int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (probe >= 0 && connect(probe, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+        fprintf(stderr, "An MCP is already listening on %s\n", listen_path);
+        exit(EXIT_FAILURE);
+    }
+    if (probe >= 0) close(probe);
+    unlink(listen_path);
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    mode_t old_mask = umask(077); //only the user who started the daemon can submit jobs to it
+    int bound = listen_fd >= 0 ? bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) : -1;
+    umask(old_mask);
+    if (bound < 0 || listen(listen_fd, SOMAXCONN) < 0) {
+        perror("listen");
+        exit(EXIT_FAILURE);
+    }
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev);
+    printf("MCP: Listening on %s\n", listen_path);
+}
+
+void stop_listening(void) {
+    //closes and removes the socket, the loop ends once the jobs left have finished
+    //connected clients stay, so they can still watch and cancel what is left
+    if (listen_fd < 0) return;
+    close(listen_fd);
+    listen_fd = -1;
+    unlink(listen_path);
+    printf("MCP: No longer accepting jobs\n");
+}
+
+void handle_listen_event(void) {
+    //accepts waiting clients
+    int fd;
+    while ((fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        int i = 0;
+        while (i < MAX_CLIENTS && clients[i].fd >= 0) i++;
+        if (i == MAX_CLIENTS) {
+            send(fd, "error too many clients\n", 23, MSG_NOSIGNAL | MSG_DONTWAIT);
+            close(fd);
+            continue;
+        }
+        clients[i].fd = fd;
+        clients[i].length = 0;
+        clients[i].watching = 0;
+        clients[i].streaming = 0;
+        struct epoll_event ev = { .events = EPOLLIN, .data.u32 = EV_CLIENT | i };
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+    }
+}
+
+void handle_client_event(int index, unsigned events) {
+    //sends a client's pending replies once its socket is writable, and runs the complete command lines
+    //it sent, keeping the start of an unfinished one
+    client_t *c = &clients[index];
+    if (c->fd < 0) return; //closed by an earlier event of the same batch
+    if (events & EPOLLOUT) client_flush(index);
+    if (!(events & (EPOLLIN | EPOLLHUP | EPOLLERR))) return;
+    ssize_t n = read(c->fd, c->buffer + c->length, sizeof(c->buffer) - 1 - c->length);
+    if (n < 0 && errno == EAGAIN) return;
+    if (n <= 0) {
+        client_close(index);
+        return;
+    }
+    if (c->watching) return; //a streaming client only reads, the drain thread owns its socket's output
+    c->length += n;
+    c->buffer[c->length] = '\0';
+
+    char *line = c->buffer, *end;
+    while (c->fd >= 0 && (end = strchr(line, '\n')) != NULL) {
+        *end = '\0';
+        if (end > line && end[-1] == '\r') end[-1] = '\0';
+        run_command(line, index);
+        line = end + 1;
+    }
+    if (c->fd < 0) return;
+    c->length -= line - c->buffer;
+    memmove(c->buffer, line, c->length);
+    if (c->length == sizeof(c->buffer) - 1) {
+        reply(index, "error line longer than %d bytes\n", CONTROL_MAX - 1);
+        c->length = 0;
+    }
+}
+
+void client_close(int index) {
+    //drops a client, under the lock so the drain isn't sending to it as its fd is closed
+    client_t *c = &clients[index];
+    pthread_mutex_lock(&stream_lock);
+    if (c->streaming) atomic_fetch_sub(&stream_count, 1);
+    c->streaming = 0;
+    close(c->fd); //also takes it out of the epoll set
+    c->fd = -1;
+    pthread_mutex_unlock(&stream_lock);
+    free(c->pending);
+    c->pending = NULL;
+    c->pending_length = c->pending_capacity = 0;
+}
+
+void client_flush(int index) {
+    //sends what the socket takes of a client's pending replies; once they are all sent the client is
+    //only watched for input again, and one that asked to stream is handed to the drain thread
+    client_t *c = &clients[index];
+    size_t sent = 0;
+    while (sent < c->pending_length) {
+        ssize_t k = send(c->fd, c->pending + sent, c->pending_length - sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (k < 0 && errno == EAGAIN) break;
+        if (k <= 0) {
+            shutdown(c->fd, SHUT_RDWR); //its next event reads end of file and closes it
+            sent = c->pending_length;
+            break;
+        }
+        sent += k;
+    }
+    c->pending_length -= sent;
+    memmove(c->pending, c->pending + sent, c->pending_length);
+    if (c->pending_length > 0) return;
+    struct epoll_event ev = { .events = EPOLLIN, .data.u32 = EV_CLIENT | index };
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
+    if (c->watching) client_stream(index);
+}
+
+void client_stream(int index) {
+    //hands a watching client to the drain thread, which copies every log line to it from now on
+    pthread_mutex_lock(&stream_lock);
+    clients[index].streaming = 1;
+    atomic_fetch_add(&stream_count, 1);
+    pthread_mutex_unlock(&stream_lock);
+}
+
+void reply(int client, const char *format, ...) {
+    //a line of output for whoever sent the command: stdout for stdin, else the client's socket
+    //what the socket doesn't take at once waits in the client's pending buffer and goes out as the socket
+    //becomes writable, so a slow client never stalls the scheduler; one that leaves REPLY_BUFFER unread is
+    //cut off; a streaming client sends no more commands, so replies never race the drain thread's lines
+    char buffer[CONTROL_MAX + 256];
+    va_list args;
+    va_start(args, format);
+    if (client < 0) {
+        vprintf(format, args);
+        va_end(args);
+        return;
+    }
+    int n = vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    if (n >= (int)sizeof(buffer)) n = sizeof(buffer) - 1;
+
+    client_t *c = &clients[client];
+    if (c->fd < 0) return;
+    ssize_t sent = 0;
+    if (c->pending_length == 0) {
+        //nothing queued ahead of it, so it can go straight out
+        sent = send(c->fd, buffer, n, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (sent < 0 && errno != EAGAIN) {
+            shutdown(c->fd, SHUT_RDWR); //its next event reads end of file and closes it
+            return;
+        }
+        if (sent < 0) sent = 0;
+        if (sent == n) return;
+    }
+    if (c->pending_length + n - sent > REPLY_BUFFER) {
+        shutdown(c->fd, SHUT_RDWR);
+        return;
+    }
+    if (c->pending_length + n - sent > c->pending_capacity) {
+        size_t capacity = c->pending_capacity ? c->pending_capacity : sizeof(buffer);
+        while (capacity < c->pending_length + n - sent) capacity *= 2;
+        char *grown = realloc(c->pending, capacity);
+        if (!grown) {
+            perror("realloc");
+            exit(EXIT_FAILURE);
+        }
+        c->pending = grown;
+        c->pending_capacity = capacity;
+    }
+    if (c->pending_length == 0) {
+        struct epoll_event ev = { .events = EPOLLIN | EPOLLOUT, .data.u32 = EV_CLIENT | client };
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
+    }
+    memcpy(c->pending + c->pending_length, buffer + sent, n - sent);
+    c->pending_length += n - sent;
+}
+
+void submit_job(char *line, int client) {
+    //queues a job line for admission at the top of the loop, replying with its serial, after any warnings
+    //about its options; arrive= counts from now, and after= can name any job submitted before that is
+    //unfinished or among the DAG_RETAIN that finished last
+    job_client = client;
+    process_t *p = make_job(line);
+    job_client = -1;
+    if (!p && job_error[0]) {
+        reply(client, client < 0 ? "MCP: Not submitted, %s\n" : "error %s\n", job_error);
+        return;
+    }
+    if (!p) {
+        reply(client, client < 0 ? "MCP: Nothing to submit\n" : "error empty job line\n");
+        return;
+    }
+    p->submitted_at = now_ns() + p->arrive;
+    if (submitted) submitted_tail->job_next = p;
+    else submitted = p;
+    submitted_tail = p;
+    if (client < 0) printf("MCP: Submitted job %ld\n", p->serial);
+    else reply(client, "ok %ld\n", p->serial);
+}
+
+void job_warning(const char *format, ...) {
+    //a problem with a job line: a daemon client reads it in the reply to its submit, before the "ok",
+    //the file and stdin get it on stderr as before
+    char buffer[CONTROL_MAX + 256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    if (job_client >= 0) reply(job_client, "%s", buffer);
+    else fputs(buffer, stderr);
+}
+
+void cancel_job(long serial, int client) {
+    //kills a job, or marks it to be skipped if it hasn't started; its exit counts as a failure, so jobs
+    //after it are skipped too
+    process_t *p = find_job(serial);
+    if (!p) {
+        reply(client, client < 0 ? "MCP: No unfinished job %ld\n" : "error no unfinished job %ld\n", serial);
+        return;
+    }
+    if (p->pid <= 0) p->cancelled = 1;
+    else kill_job(p);
+    if (client >= 0) reply(client, "ok\n");
+}
+
+void cancel_pending(void) {
+    //quit: closes the job file and marks every job that hasn't started to be skipped, arriving, ready,
+    //submitted or held by after=; admit_jobs drains them without spawning, so the loop ends once the
+    //live jobs are reaped
+    if (job_file) {
+        fclose(job_file);
+        job_file = NULL;
+    }
+    process_t *lists[] = { ready, submitted };
+    for (int k = 0; k < 2; k++) {
+        for (process_t *p = lists[k]; p; p = p->job_next) p->cancelled = 1;
+    }
+    if (arriving) arriving->cancelled = 1;
+    for (size_t i = 0; i < dag_capacity; i++) {
+        dag_node_t *node = dag_table[i];
+        for (int k = 0; node && k < node->waiter_count; k++) node->waiters[k]->cancelled = 1;
+    }
+}
+
+process_t *find_job(long serial) {
+    //unfinished job with that serial, wherever it waits: running or queued, ready, held by after=,
+    //arriving or submitted; a scan, cancelling is rare
+    process_t *lists[] = { jobs, ready, submitted };
+    for (int k = 0; k < 3; k++) {
+        for (process_t *p = lists[k]; p; p = p->job_next) {
+            if (p->serial == serial) return p;
+        }
+    }
+    if (arriving && arriving->serial == serial) return arriving;
+    for (size_t i = 0; i < dag_capacity; i++) {
+        dag_node_t *node = dag_table[i];
+        for (int k = 0; node && k < node->waiter_count; k++) {
+            if (node->waiters[k]->serial == serial) return node->waiters[k];
+        }
+    }
+    return NULL;
+}
+
+void stream_line(const char *line) {
+    //drain thread: copies a log line to every streaming client, never waiting on one; a client too slow
+    //to keep up is shut down, and the scheduler closes it when it reads the end of file
+    size_t length = strlen(line);
+    pthread_mutex_lock(&stream_lock);
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        if (!clients[i].streaming) continue;
+        if (send(clients[i].fd, line, length, MSG_NOSIGNAL | MSG_DONTWAIT) != (ssize_t)length) {
+            shutdown(clients[i].fd, SHUT_RDWR);
+            clients[i].streaming = 0;
+            atomic_fetch_sub(&stream_count, 1);
+        }
+    }
+    pthread_mutex_unlock(&stream_lock);
+}
+
+void setup_simulation(void) {
+    //slots and virtual clock for --simulate, in place of setup_event_loop
+    //without -j the simulated machine has one slot per cpu of this one, like a real run
+    setup_slots();
+    tick_ns = 1; //read_proc_stats reports simulated cpu time in ns
+    page_kb = 1;
+    sim_now = 0;
+}
+
+void run_simulation(void) {
+    //replays events in virtual time until every job has finished
+    //nothing sleeps, the clock jumps straight to the next event, so an hour of scheduling costs only the
+    //decisions the scheduler core makes in it
+    struct timespec started, ended;
+    sim_event_t e;
+
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    if (strcmp(policy->name, "mlfq") == 0) sim_push(SIM_BOOST, sim_now + boost_interval, -1, 0, 0);
+    while (1) {
+        if (more_jobs() && live_count < admit_window) admit_jobs();
+        if (live_count == 0 && !more_jobs()) break;
+        if (!sim_pop(&e)) {
+            fprintf(stderr, "MCP: Simulation stalled with %d jobs left\n", live_count);
+            exit(EXIT_FAILURE);
+        }
+        sim_now = e.time;
+        sim_events++;
+        process_t *p = e.type == SIM_BURST || e.type == SIM_IO ? pid_lookup(e.pid) : NULL;
+        switch (e.type) {
+        case SIM_TIMER:
+            if (e.seq == slots[e.slot].timer_seq) schedule_slot(e.slot, 1);
+            break;
+        case SIM_BURST:
+            if (p && e.seq == p->sim_seq) sim_burst_event(p);
+            break;
+        case SIM_IO:
+            if (p) sim_next_burst(p); //i/o waits are never cancelled, the job only leaves its slot
+            break;
+        case SIM_ARRIVE:
+            break; //admission at the top of the loop takes the job that arrived
+        case SIM_BOOST:
+            boost_priorities();
+            sim_push(SIM_BOOST, sim_now + boost_interval, -1, 0, 0);
+            break;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &ended);
+    printf("MCP: Simulated %.3f s in %.3f s, %ld events\n", (last_finish - batch_start) / 1e9,
+           (ended.tv_sec - started.tv_sec) + (ended.tv_nsec - started.tv_nsec) / 1e9, sim_events);
+}
+
+static int sim_before(sim_event_t *a, sim_event_t *b) {
+    //earlier time first; at the same instant a job's burst end, exit or i/o end goes before anything else,
+    //so a burst that ends just as the quantum does finishes instead of being cancelled by the preemption,
+    //and the rest keep push order
+    if (a->time != b->time) return a->time < b->time;
+    int a_job = a->type == SIM_BURST || a->type == SIM_IO, b_job = b->type == SIM_BURST || b->type == SIM_IO;
+    if (a_job != b_job) return a_job;
+    return a->order < b->order;
+}
+
+void sim_push(int type, long long time, int slot, pid_t pid, unsigned seq) {
+    //schedules a virtual event
+    if (sim_length == sim_capacity) {
+        sim_capacity = sim_capacity ? sim_capacity * 2 : 1024;
+        sim_heap = realloc(sim_heap, sim_capacity * sizeof(sim_event_t));
+        if (!sim_heap) {
+            perror("realloc");
+            exit(EXIT_FAILURE);
+        }
+    }
+    sim_event_t e = { .time = time, .order = sim_order++, .type = type, .slot = slot, .pid = pid, .seq = seq };
+    size_t i = sim_length++;
+    while (i > 0 && sim_before(&e, &sim_heap[(i - 1) / 2])) {
+        sim_heap[i] = sim_heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    sim_heap[i] = e;
+}
+
+int sim_pop(sim_event_t *e) {
+    //takes the earliest event off the heap, 0 if it is empty
+    if (sim_length == 0) return 0;
+    *e = sim_heap[0];
+    sim_event_t last = sim_heap[--sim_length];
+    size_t i = 0;
+    while (2 * i + 1 < sim_length) {
+        size_t child = 2 * i + 1;
+        if (child + 1 < sim_length && sim_before(&sim_heap[child + 1], &sim_heap[child])) child++;
+        if (!sim_before(&sim_heap[child], &last)) break;
+        sim_heap[i] = sim_heap[child];
+        i = child;
+    }
+    sim_heap[i] = last;
+    return 1;
+}
+
+pid_t sim_spawn(process_t *p) {
+    //parses p's profile in place of starting it, -1 with errno set if it has none
+    //"name cpu:40ms io:5ms x100": cpu bursts progress only while the job holds a slot, i/o waits run out
+    //in virtual time whether it does or not, and a trailing xN repeats the whole pattern; a plain
+    //command with -seconds N (cpubound, iobound) is one cpu burst of N seconds
+    char *copy = strdup(p->cmd);
+    int capacity = 8;
+    p->profile = malloc(capacity * sizeof(long long));
+    if (!copy || !p->profile) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    p->profile_length = 0;
+    long long repeat = 1;
+
+    char *save, *token = strtok_r(copy, " ", &save); //the name, only used for srtf history and the log
+    while ((token = strtok_r(NULL, " ", &save)) != NULL) {
+        int io = strncmp(token, "io:", 3) == 0;
+        if (!io && strncmp(token, "cpu:", 4) != 0) {
+            char *end;
+            errno = 0;
+            long long count = token[0] == 'x' ? strtoll(token + 1, &end, 10) : 0;
+            if (count > 0 && *end == '\0') {
+                if (errno == ERANGE) {
+                    free(copy);
+                    errno = EOVERFLOW;
+                    return -1;
+                }
+                repeat = count;
+            }
+            continue; //arguments of a plain command
+        }
+        //checked before the sign is applied, so any length down to io:1ns is a valid wait
+        long long length = parse_duration(token + (io ? 3 : 4));
+        if (length < 0) {
+            free(copy);
+            errno = EINVAL;
+            return -1;
+        }
+        if (length == 0) continue; //an empty burst changes nothing
+        if (io) length = -length;
+        if (p->profile_length == capacity) {
+            capacity *= 2;
+            p->profile = realloc(p->profile, capacity * sizeof(long long));
+            if (!p->profile) {
+                perror("realloc");
+                exit(EXIT_FAILURE);
+            }
+        }
+        p->profile[p->profile_length++] = length;
+    }
+    free(copy);
+
+    if (p->profile_length == 0 && p->hint > 0) p->profile[p->profile_length++] = p->hint;
+    if (p->profile_length == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    //counted once here, the burst index is checked against it at every event
+    if (__builtin_mul_overflow((long long)p->profile_length, repeat, &p->profile_total)) {
+        errno = EOVERFLOW;
+        return -1;
+    }
+    return (pid_t)p->serial; //never reused, so no event of a finished job can find a new one
+}
+
+void sim_suspend(process_t *p) {
+    //p lost its slot: its cpu burst stops progressing
+    if (p->cpu_since < 0) return;
+    long long used = sim_now - p->cpu_since;
+    p->sim_cpu += used;
+    p->burst_left -= used;
+    p->cpu_since = -1;
+    p->sim_seq++; //cancels the pending SIM_BURST
+}
+
+void sim_resume(process_t *p) {
+    //p got a slot: its cpu burst progresses again, or its first burst starts
+    //a job waiting on i/o holds the slot idle until the quantum ends, as a blocked process would
+    if (p->burst < 0) sim_next_burst(p);
+    else if (p->burst >= p->profile_total || p->profile[p->burst % p->profile_length] > 0) sim_run(p);
+}
+
+void sim_run(process_t *p) {
+    //p holds a slot and isn't waiting: schedules the end of its cpu burst, or its exit if no burst is left
+    int done = p->burst >= p->profile_total;
+    p->cpu_since = sim_now;
+    sim_push(SIM_BURST, sim_now + (done ? 0 : p->burst_left), -1, p->pid, ++p->sim_seq);
+}
+
+void sim_next_burst(process_t *p) {
+    //p's burst ended, starts the next one
+    while (++p->burst < p->profile_total) {
+        long long length = p->profile[p->burst % p->profile_length];
+        if (length < 0) {
+            p->burst_left = sim_now - length;
+            sim_push(SIM_IO, p->burst_left, -1, p->pid, 0);
+            return;
+        }
+        p->burst_left = length;
+        if (length > 0) break;
+    }
+    if (p->slot >= 0) sim_run(p); //otherwise the burst starts with its next slice
+}
+
+void sim_burst_event(process_t *p) {
+    //p's cpu burst ran out, or it has no burst left and exits
+    int done = p->burst >= p->profile_total;
+    sim_suspend(p); //charges the burst, the slot is still p's
+    if (!done) {
+        sim_next_burst(p);
+        return;
+    }
+    pid_remove(p->pid);
+    p->cpu_ns = p->sim_cpu;
+    finish_job(p);
+}